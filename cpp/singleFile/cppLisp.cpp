@@ -1,705 +1,6775 @@
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 class Obj;
+class Value;
 class Env;
+struct Node;
 using ObjPtr = unique_ptr<Obj>;
-ObjPtr evalExprs(Env &, size_t &, string_view expr, size_t end);
+using NodePtr = unique_ptr<Node>;
+using BinaryOp = function<double(double, double)>;
+Value evalExpr(Env &env, const Node &node);
+Value evalForm(Env &env, const Node &form);
+Value evalExprs(Env &env, string_view source);
+
+// In the order of their builtin symbols: + - * / == !=
+static const BinaryOp operators[] = {
+    plus<double>(),
+    minus<double>(),
+    multiplies<double>(),
+    divides<double>(),
+    [](double x, double y) { return x == y ? 1.0 : 0.0; },
+    [](double x, double y) { return x != y ? 1.0 : 0.0; }};
+
+// Every object records its class, so type checks compare a byte instead
+// of asking RTTI. The interpreter builds with -fno-rtti.
+enum class ObjType : uint8_t { String, Lambda, List, Vector, Box };
+
+// The heap that objects live in. Programs make and drop small objects at
+// a high rate, so the memory of a dropped object goes on the free list of
+// its size class and the next object of that size takes it back instead
+// of going through malloc. Fresh memory comes in blocks that hold many
+// objects, which also keeps the cells of a list close together. Objects
+// are only made and dropped on the thread that evaluates.
+//
+// Dropping the last hold on a big structure frees everything in it, so
+// frees are counted against a budget that every allocation starts afresh.
+// Once it is spent, what is left to free waits in a queue, and the next
+// allocations free some of it first. No allocation, or run of drops
+// between two of them, frees more than freeBudget objects and vector
+// nodes, however large the structure.
+//
+// Counting never frees a cycle, which boxes make possible; collectCycles
+// finds those from the objects a drop may have cut loose.
+class ObjHeap {
+public:
+  static inline size_t freeBudget = 4096;
+  static inline size_t budgetLeft = 4096;
+  static inline bool deferred = false;
+
+  // Counts one free against the budget; false once it is spent, when the
+  // caller has to leave the work for later.
+  static bool charge() {
+    if (budgetLeft == 0) {
+      return false;
+    }
+    budgetLeft--;
+    return true;
+  }
+
+  // Frees an object nothing holds any more, or queues it.
+  static void release(Obj *object);
+
+  // Notes an object that a drop left held, and that may be in a cycle.
+  static void suspect(Obj *object);
+
+  // Collects every cycle and frees everything queued, whatever the budget.
+  // Run once the program is done, so leak checkers see only real leaks.
+  static void finish();
+
+  static void *allocate(size_t size) {
+    budgetLeft = freeBudget;
+    if (deferred) [[unlikely]] {
+      freeDeferred();
+    }
+    size_t sizeClass = (size - 1) / granule;
+    if (sizeClass >= classes) {
+      return ::operator new(size);
+    }
+    FreeCell *&cell = freeLists[sizeClass];
+    if (!cell) [[unlikely]] {
+      refill(sizeClass);
+    }
+    FreeCell *taken = cell;
+    cell = taken->next;
+    return taken;
+  }
+
+  static void deallocate(void *memory, size_t size) {
+    size_t sizeClass = (size - 1) / granule;
+    if (sizeClass >= classes) {
+      ::operator delete(memory);
+      return;
+    }
+    auto *cell = static_cast<FreeCell *>(memory);
+    cell->next = freeLists[sizeClass];
+    freeLists[sizeClass] = cell;
+  }
 
-static const unordered_map<string_view, function<double(double, double)>>
-    operators = {{"+", plus<double>()},
-                 {"-", minus<double>()},
-                 {"*", multiplies<double>()},
-                 {"/", divides<double>()},
-                 {"==", [](double x, double y) { return x == y ? 1.0 : 0.0; }},
-                 {"!=", [](double x, double y) { return x != y ? 1.0 : 0.0; }}};
+private:
+  struct FreeCell {
+    FreeCell *next;
+  };
+  static constexpr size_t granule = 16;
+  static constexpr size_t classes = 4; // Objects up to 64 bytes
+  static constexpr size_t blockBytes = 16 * 1024;
+
+  static inline FreeCell *freeLists[classes] = {};
+  // Blocks are never returned; they stay until the interpreter exits.
+  static inline vector<unique_ptr<char[]>> blocks;
+  // Objects waiting to be freed. Never destroyed, as frees at exit may
+  // still add to it.
+  static inline vector<Obj *> &pending = *new vector<Obj *>();
+  // Suspected objects, each held once more by being here.
+  static inline vector<Obj *> &suspects = *new vector<Obj *>();
+  static constexpr size_t minCollect = 4096;
+  static inline size_t collectAt = minCollect;
 
+  static void freeDeferred();
+  static void collectCycles();
 
-static const vector<char> keywords{'\"', ')', '('};
+  __attribute__((noinline)) static void refill(size_t sizeClass) {
+    size_t size = (sizeClass + 1) * granule;
+    blocks.push_back(make_unique<char[]>(blockBytes));
+    char *block = blocks.back().get();
+    FreeCell *list = nullptr;
+    for (size_t offset = blockBytes - blockBytes % size; offset > 0;) {
+      offset -= size;
+      auto *cell = reinterpret_cast<FreeCell *>(block + offset);
+      cell->next = list;
+      list = cell;
+    }
+    freeLists[sizeClass] = list;
+  }
+};
 
 class Obj {
 public:
+  const ObjType type;
+  // Whether a box can be reached from here. Every cycle runs through one,
+  // so nothing else is ever suspected.
+  bool mayCycle = false;
+  bool suspected = false; // Waiting in ObjHeap's suspects
+  uint8_t mark = 0;       // Used by ObjHeap::collectCycles as it runs
+
+  // Objects never change once built, boxes aside, so every value holding
+  // one shares it and counts itself here.
+  uint32_t refs = 1;
+
+  explicit Obj(ObjType type, bool mayCycle = false)
+      : type(type), mayCycle(mayCycle) {}
   virtual ~Obj() = default;
   virtual string toString() const = 0;
-  virtual unique_ptr<Obj> clone() const = 0;
+
+  static void *operator new(size_t size) { return ObjHeap::allocate(size); }
+  static void operator delete(void *memory, size_t size) {
+    ObjHeap::deallocate(memory, size);
+  }
 };
 
-class NumberObj : public Obj {
+// A value is 64 bits wide. A number is the double itself. Anything else is
+// a negative quiet NaN with a tag in bits 48-50 and a payload below them:
+// void has none, an object has the pointer to the heap object it shares.
+// Unbound has none either; it only marks the slot of a define that has not
+// run yet and is never the value of an expression.
+// Arithmetic NaNs are stored as the positive quiet NaN, so no number is
+// ever mistaken for a tagged value.
+class Value {
 public:
-  double value;
-  explicit NumberObj(double v) : value(v) {}
+  Value() = default;
+
+  explicit Value(double number) {
+    if (number != number) {
+      bits = quietNaN;
+    } else {
+      memcpy(&bits, &number, sizeof bits);
+    }
+  }
+
+  explicit Value(ObjPtr obj)
+      : bits(tagged(ObjectTag, reinterpret_cast<uintptr_t>(obj.release()))) {}
+
+  static Value voidValue() {
+    Value value;
+    value.bits = tagged(VoidTag, 0);
+    return value;
+  }
+
+  static Value unbound() {
+    Value value;
+    value.bits = tagged(UnboundTag, 0);
+    return value;
+  }
+
+  Value(Value &&other) noexcept : bits(exchange(other.bits, 0)) {}
+
+  Value &operator=(Value &&other) noexcept {
+    if (this != &other) {
+      release();
+      bits = exchange(other.bits, 0);
+    }
+    return *this;
+  }
+
+  Value(const Value &other) : bits(other.bits) { retain(); }
+
+  Value &operator=(const Value &other) {
+    other.retain(); // before release, in case other is this
+    release();
+    bits = other.bits;
+    return *this;
+  }
+
+  ~Value() { release(); }
+
+  bool isNumber() const { return bits < boxed; }
+  bool isVoid() const { return bits == tagged(VoidTag, 0); }
+  bool isUnbound() const { return bits == tagged(UnboundTag, 0); }
+
+  bool mayCycle() const {
+    Obj *object = obj();
+    return object && object->mayCycle;
+  }
+
+  double number() const {
+    double number;
+    memcpy(&number, &bits, sizeof number);
+    return number;
+  }
+
+  // The object, or nullptr for an immediate value.
+  Obj *obj() const {
+    return (bits & ~payloadMask) == tagged(ObjectTag, 0)
+               ? reinterpret_cast<Obj *>(bits & payloadMask)
+               : nullptr;
+  }
+
+  // The object if it is a T, otherwise nullptr.
+  template <class T> T *as() const {
+    Obj *object = obj();
+    return object && object->type == T::objType ? static_cast<T *>(object)
+                                                 : nullptr;
+  }
+
+  // Like as, but a value of any other type is an error.
+  template <class T> T &expect(const char *message) const {
+    if (T *object = as<T>()) {
+      return *object;
+    }
+    throw runtime_error(message);
+  }
+
+  string toString() const;
+
+private:
+  enum Tag : uint64_t { VoidTag = 1, ObjectTag = 2, UnboundTag = 3 };
+  static constexpr uint64_t boxed = 0xFFF8000000000000;
+  static constexpr uint64_t quietNaN = 0x7FF8000000000000;
+  static constexpr uint64_t payloadMask = (uint64_t(1) << 48) - 1;
+
+  uint64_t bits = 0; // 0.0
+
+  static constexpr uint64_t tagged(Tag tag, uint64_t payload) {
+    return boxed | tag << 48 | payload;
+  }
+
+  void retain() const {
+    if (Obj *object = obj()) {
+      object->refs++;
+    }
+  }
 
-  string toString() const override { return to_string(value); }
+  // Numbers never own anything, so only objects leave the inline path.
+  void release() {
+    if (Obj *object = obj()) [[unlikely]] {
+      drop(object);
+    }
+  }
 
-  unique_ptr<Obj> clone() const override {
-    return make_unique<NumberObj>(value);
+  __attribute__((noinline)) static void drop(Obj *object) {
+    if (--object->refs == 0) {
+      ObjHeap::release(object);
+    } else if (object->mayCycle && !object->suspected) {
+      ObjHeap::suspect(object);
+    }
   }
 };
 
 class StringObj : public Obj {
 public:
+  static constexpr ObjType objType = ObjType::String;
   string_view value; // Changed to string_view
-  explicit StringObj(string_view v) : value(v) {}
+  shared_ptr<const string> owner; // Set for strings built at runtime
+  explicit StringObj(string_view v) : Obj(objType), value(v) {}
+  explicit StringObj(string s)
+      : Obj(objType), owner(make_shared<const string>(std::move(s))) {
+    value = *owner;
+  }
 
   string toString() const override { return "\"" + string(value) + "\""; }
+};
+
+class LambdaObj : public Obj {
+public:
+  static constexpr ObjType objType = ObjType::Lambda;
+  const Node *const def; // The lambda form; parsed forms outlive values
+  // The variables the body uses from enclosing scopes, copied when the
+  // lambda is made. A call binds them in the slots after the parameters.
+  const vector<Value> captured;
 
-  unique_ptr<Obj> clone() const override {
-    return make_unique<StringObj>(value); // No need to copy, just pass the view
+  explicit LambdaObj(const Node *def, vector<Value> captured = {})
+      : Obj(objType), def(def), captured(std::move(captured)) {
+    for (const auto &value : this->captured) {
+      mayCycle = mayCycle || value.mayCycle();
+    }
   }
+
+  string toString() const override;
 };
 
-class LambdaObj : public Obj {
+// A variable that a lambda captures and that is assigned lives in a box,
+// which its frame and every lambda over it share, so each sees the others'
+// assignments. Frames read through the box; a box is never a value itself.
+// A box can come to hold a lambda over itself, so boxes are what
+// ObjHeap::collectCycles looks for.
+class BoxObj : public Obj {
+public:
+  static constexpr ObjType objType = ObjType::Box;
+  Value value;
+
+  explicit BoxObj(Value value = Value())
+      : Obj(objType, true), value(std::move(value)) {}
+
+  string toString() const override { return value.toString(); }
+};
+
+// A list is a chain of cons cells ending in an empty cell. Cells are
+// shared, so cons and cdr reuse the tail instead of copying it.
+class ListObj : public Obj {
 public:
-  vector<string_view> params; // Changed to string_view
-  string_view body;           // Changed to string_view
+  static constexpr ObjType objType = ObjType::List;
+  Value first;
+  Value rest; // The cell after this one; unset in the empty cell
+  size_t length = 0;
+
+  ListObj() : Obj(objType) {}
+
+  ListObj(Value first, Value rest)
+      : Obj(objType), first(std::move(first)), rest(std::move(rest)) {
+    length = next()->length + 1;
+    mayCycle = this->first.mayCycle() || this->rest.mayCycle();
+  }
 
-  LambdaObj(const vector<string_view> &params, string_view body)
-      : params(params), body(body) {}
+  ~ListObj() override {
+    // Free the cells only this one holds here, so dropping a long list
+    // doesn't recurse once per cell. Once the heap's budget is spent, the
+    // cell where this stops is queued with the rest still behind it.
+    Value cell = std::move(rest);
+    while (auto *list = cell.as<ListObj>()) {
+      if (list->refs != 1 || ObjHeap::budgetLeft == 0) {
+        break;
+      }
+      Value after = std::move(list->rest);
+      cell = std::move(after);
+    }
+  }
+
+  const ListObj *next() const { return rest.as<ListObj>(); }
 
   string toString() const override {
-    string result = "(lambda (";
-    for (size_t i = 0; i < params.size(); i++) {
-      if (i > 0)
+    string result = "(";
+    for (const ListObj *list = this; list->length > 0; list = list->next()) {
+      if (list != this)
         result += " ";
-      result += string(params[i]);
+      result += list->first.toString();
     }
-    result += ") ";
-    result += string(body);
     result += ")";
     return result;
   }
+};
 
-  unique_ptr<Obj> clone() const override {
-    return make_unique<LambdaObj>(params, body); // No need to copy strings
+// Vectors are relaxed radix balanced trees with 32-way branching. Every
+// node knows its size. A relaxed node also keeps the running sizes of its
+// children, needed once concat or slice leave a child short of full; the
+// others find a child by shifting the index. Nodes are shared and never
+// change, so an update copies only the path from the root.
+static constexpr int vecBits = 5;
+static constexpr size_t vecWidth = size_t(1) << vecBits;
+
+struct VecNode;
+using VecPtr = shared_ptr<const VecNode>;
+
+struct VecNode {
+  size_t size = 0;
+  vector<Value> items;     // A leaf's elements
+  vector<VecPtr> children; // An inner node's subtrees
+  vector<size_t> sizes;    // Running child sizes, empty unless relaxed
+  bool mayCycle = false;   // As for an object
+
+  // Subtrees waiting to be freed, like the heap's objects.
+  static inline vector<VecPtr> &pending = *new vector<VecPtr>();
+
+  ~VecNode() {
+    // Every node counts against the heap's budget. Past it, the subtrees
+    // only this node holds are queued instead of freed along with it.
+    if (ObjHeap::charge()) {
+      return;
+    }
+    for (auto &child : children) {
+      if (child.use_count() == 1) {
+        pending.push_back(std::move(child));
+        ObjHeap::deferred = true;
+      }
+    }
   }
 };
 
-class VoidObj : public Obj {
-public:
-  VoidObj() = default;
+void ObjHeap::release(Obj *object) {
+  if (charge()) {
+    delete object;
+  } else {
+    pending.push_back(object);
+    deferred = true;
+  }
+}
 
-  string toString() const override { return ""; }
+void ObjHeap::suspect(Obj *object) {
+  object->suspected = true;
+  object->refs++;
+  suspects.push_back(object);
+  if (suspects.size() >= collectAt) {
+    deferred = true;
+  }
+}
 
-  unique_ptr<Obj> clone() const override { return make_unique<VoidObj>(); }
-};
+void ObjHeap::finish() {
+  while (!suspects.empty() || deferred) {
+    if (!suspects.empty()) {
+      collectCycles();
+    }
+    budgetLeft = freeBudget;
+    freeDeferred();
+  }
+}
 
-class ListObj : public Obj {
+void ObjHeap::freeDeferred() {
+  if (suspects.size() >= collectAt) {
+    collectCycles();
+  }
+  while (!VecNode::pending.empty() && budgetLeft > 0) {
+    VecPtr node = std::move(VecNode::pending.back());
+    VecNode::pending.pop_back();
+  }
+  while (!pending.empty() && charge()) {
+    Obj *object = pending.back();
+    pending.pop_back();
+    delete object;
+  }
+  deferred = !pending.empty() || !VecNode::pending.empty() ||
+             suspects.size() >= collectAt;
+}
+
+// The elements a full node of the given height holds. Leaves are height 0.
+static size_t vecCapacity(int height) {
+  return size_t(1) << (vecBits * (height + 1));
+}
+
+static VecPtr vecLeaf(vector<Value> items) {
+  auto node = make_shared<VecNode>();
+  node->size = items.size();
+  node->items = std::move(items);
+  for (const auto &item : node->items) {
+    node->mayCycle = node->mayCycle || item.mayCycle();
+  }
+  return node;
+}
+
+static VecPtr vecInner(vector<VecPtr> children, int height) {
+  auto node = make_shared<VecNode>();
+  bool relaxed = false;
+  for (size_t i = 0; i < children.size(); i++) {
+    node->size += children[i]->size;
+    node->sizes.push_back(node->size);
+    node->mayCycle = node->mayCycle || children[i]->mayCycle;
+    relaxed = relaxed || (i + 1 < children.size() &&
+                          children[i]->size != vecCapacity(height - 1));
+  }
+  if (!relaxed) {
+    node->sizes.clear();
+  }
+  node->children = std::move(children);
+  return node;
+}
+
+// The slot of node's child holding element index, which is made relative to
+// that child. The shifted index is never past the right slot.
+static size_t vecSlot(const VecNode &node, int height, size_t &index) {
+  size_t slot = index >> (vecBits * height);
+  if (node.sizes.empty()) {
+    index -= slot << (vecBits * height);
+    return slot;
+  }
+  while (node.sizes[slot] <= index) {
+    slot++;
+  }
+  if (slot > 0) {
+    index -= node.sizes[slot - 1];
+  }
+  return slot;
+}
+
+static size_t vecSlots(const VecNode &node, int height) {
+  return height == 0 ? node.items.size() : node.children.size();
+}
+
+// A branch of the given height holding only value.
+static VecPtr vecPath(int height, Value value) {
+  vector<Value> items;
+  items.push_back(std::move(value));
+  VecPtr node = vecLeaf(std::move(items));
+  for (int h = 1; h <= height; h++) {
+    node = vecInner({node}, h);
+  }
+  return node;
+}
+
+// node with value appended, or nullptr when its rightmost path is full.
+// value is only moved from on success.
+static VecPtr vecPush(const VecNode &node, int height, Value &value) {
+  if (height == 0) {
+    if (node.items.size() == vecWidth) {
+      return nullptr;
+    }
+    vector<Value> items = node.items;
+    items.push_back(std::move(value));
+    return vecLeaf(std::move(items));
+  }
+  vector<VecPtr> children = node.children;
+  if (VecPtr last = vecPush(*children.back(), height - 1, value)) {
+    children.back() = std::move(last);
+  } else if (children.size() < vecWidth) {
+    children.push_back(vecPath(height - 1, std::move(value)));
+  } else {
+    return nullptr;
+  }
+  return vecInner(std::move(children), height);
+}
+
+static VecPtr vecSet(const VecNode &node, int height, size_t index,
+                     Value value) {
+  auto copy = make_shared<VecNode>(node);
+  if (height == 0) {
+    copy->mayCycle = copy->mayCycle || value.mayCycle();
+    copy->items[index] = std::move(value);
+  } else {
+    size_t slot = vecSlot(node, height, index);
+    copy->children[slot] =
+        vecSet(*node.children[slot], height - 1, index, std::move(value));
+    copy->mayCycle = copy->mayCycle || copy->children[slot]->mayCycle;
+  }
+  return copy;
+}
+
+// The first count elements of node, 0 < count.
+static VecPtr vecTake(const VecPtr &node, int height, size_t count) {
+  if (count == node->size) {
+    return node;
+  }
+  if (height == 0) {
+    const auto &items = node->items;
+    return vecLeaf(vector<Value>(items.begin(), items.begin() + count));
+  }
+  size_t index = count - 1;
+  size_t slot = vecSlot(*node, height, index);
+  vector<VecPtr> children(node->children.begin(),
+                          node->children.begin() + slot + 1);
+  children.back() = vecTake(children.back(), height - 1, index + 1);
+  return vecInner(std::move(children), height);
+}
+
+// node without its first count elements, count < size.
+static VecPtr vecDrop(const VecPtr &node, int height, size_t count) {
+  if (count == 0) {
+    return node;
+  }
+  if (height == 0) {
+    const auto &items = node->items;
+    return vecLeaf(vector<Value>(items.begin() + count, items.end()));
+  }
+  size_t index = count;
+  size_t slot = vecSlot(*node, height, index);
+  vector<VecPtr> children(node->children.begin() + slot,
+                          node->children.end());
+  children.front() = vecDrop(children.front(), height - 1, index);
+  return vecInner(std::move(children), height);
+}
+
+// Packs nodes of height - 1 into one or two nodes of the given height.
+// The concat plan first moves slots leftwards until there are at most two
+// more nodes than the minimum, which bounds how far a relaxed lookup scans.
+static vector<VecPtr> vecRebalance(const vector<VecPtr> &nodes, int height) {
+  static constexpr size_t extraNodes = 2;
+  int below = height - 1;
+  vector<size_t> counts;
+  size_t total = 0;
+  for (const auto &node : nodes) {
+    counts.push_back(vecSlots(*node, below));
+    total += counts.back();
+  }
+  size_t optimal = (total + vecWidth - 1) / vecWidth;
+  size_t length = counts.size();
+  for (size_t i = 0; length > optimal + extraNodes; length--, i--) {
+    while (counts[i] == vecWidth) {
+      i++;
+    }
+    // Pour node i into the ones after it until one of them is dropped.
+    size_t remaining = counts[i];
+    do {
+      size_t size = min(remaining + counts[i + 1], vecWidth);
+      remaining = remaining + counts[i + 1] - size;
+      counts[i++] = size;
+    } while (remaining > 0);
+    copy(counts.begin() + i + 1, counts.begin() + length, counts.begin() + i);
+  }
+  counts.resize(length);
+
+  vector<VecPtr> packed;
+  size_t from = 0, offset = 0;
+  for (size_t count : counts) {
+    if (offset == 0 && vecSlots(*nodes[from], below) == count) {
+      packed.push_back(nodes[from++]);
+      continue;
+    }
+    vector<Value> items;
+    vector<VecPtr> children;
+    while (count > 0) {
+      const VecNode &node = *nodes[from];
+      size_t take = min(count, vecSlots(node, below) - offset);
+      if (below == 0) {
+        items.insert(items.end(), node.items.begin() + offset,
+                     node.items.begin() + offset + take);
+      } else {
+        children.insert(children.end(), node.children.begin() + offset,
+                        node.children.begin() + offset + take);
+      }
+      count -= take;
+      offset += take;
+      if (offset == vecSlots(node, below)) {
+        from++;
+        offset = 0;
+      }
+    }
+    packed.push_back(below == 0 ? vecLeaf(std::move(items))
+                                : vecInner(std::move(children), below));
+  }
+
+  if (packed.size() <= vecWidth) {
+    return {vecInner(std::move(packed), height)};
+  }
+  vector<VecPtr> rest(packed.begin() + vecWidth, packed.end());
+  packed.resize(vecWidth);
+  return {vecInner(std::move(packed), height),
+          vecInner(std::move(rest), height)};
+}
+
+// Joins two trees into one or two nodes as tall as the taller tree. Only
+// the nodes along the seam are rebuilt.
+static vector<VecPtr> vecMerge(const VecPtr &left, int leftHeight,
+                               const VecPtr &right, int rightHeight) {
+  if (leftHeight == 0 && rightHeight == 0) {
+    if (left->size + right->size > vecWidth) {
+      return {left, right};
+    }
+    vector<Value> items = left->items;
+    items.insert(items.end(), right->items.begin(), right->items.end());
+    return {vecLeaf(std::move(items))};
+  }
+  int height = max(leftHeight, rightHeight);
+  bool splitLeft = leftHeight == height, splitRight = rightHeight == height;
+  vector<VecPtr> nodes;
+  if (splitLeft) {
+    nodes.assign(left->children.begin(), left->children.end() - 1);
+  }
+  vector<VecPtr> seam =
+      vecMerge(splitLeft ? left->children.back() : left,
+               splitLeft ? leftHeight - 1 : leftHeight,
+               splitRight ? right->children.front() : right,
+               splitRight ? rightHeight - 1 : rightHeight);
+  nodes.insert(nodes.end(), seam.begin(), seam.end());
+  if (splitRight) {
+    nodes.insert(nodes.end(), right->children.begin() + 1,
+                 right->children.end());
+  }
+  return vecRebalance(nodes, height);
+}
+
+class VectorObj : public Obj {
 public:
-  vector<unique_ptr<Obj>> elements;
+  static constexpr ObjType objType = ObjType::Vector;
+  VecPtr root; // nullptr when empty
+  int height = 0;
+
+  VectorObj() : Obj(objType) {}
+
+  VectorObj(VecPtr root, int height)
+      : Obj(objType), root(std::move(root)), height(height) {
+    // Trimming can leave a chain of single children at the top.
+    while (this->root && this->height > 0 &&
+           this->root->children.size() == 1) {
+      this->root = this->root->children[0];
+      this->height--;
+    }
+    mayCycle = this->root && this->root->mayCycle;
+  }
+
+  // Builds the vector bottom up, packing every node full.
+  VectorObj(Value *elements, size_t count) : Obj(objType) {
+    vector<VecPtr> level;
+    for (size_t i = 0; i < count; i += vecWidth) {
+      auto first = elements + i;
+      auto last = first + min(vecWidth, count - i);
+      level.push_back(vecLeaf(
+          vector<Value>(make_move_iterator(first), make_move_iterator(last))));
+    }
+    for (; level.size() > 1; height++) {
+      vector<VecPtr> parents;
+      for (size_t i = 0; i < level.size(); i += vecWidth) {
+        auto first = level.begin() + i;
+        auto last = first + min(vecWidth, level.size() - i);
+        parents.push_back(vecInner(vector<VecPtr>(first, last), height + 1));
+      }
+      level = std::move(parents);
+    }
+    if (!level.empty()) {
+      root = std::move(level[0]);
+      mayCycle = root->mayCycle;
+    }
+  }
+
+  size_t size() const { return root ? root->size : 0; }
+
+  const Value &at(size_t index) const {
+    const VecNode *node = root.get();
+    for (int h = height; h > 0; h--) {
+      node = node->children[vecSlot(*node, h, index)].get();
+    }
+    return node->items[index];
+  }
 
-  ListObj() = default;
+  Value push(Value value) const {
+    if (!root) {
+      return Value(make_unique<VectorObj>(vecPath(0, std::move(value)), 0));
+    }
+    if (VecPtr pushed = vecPush(*root, height, value)) {
+      return Value(make_unique<VectorObj>(std::move(pushed), height));
+    }
+    VecPtr grown = vecInner({root, vecPath(height, std::move(value))},
+                            height + 1);
+    return Value(make_unique<VectorObj>(std::move(grown), height + 1));
+  }
+
+  Value set(size_t index, Value value) const {
+    return Value(make_unique<VectorObj>(
+        vecSet(*root, height, index, std::move(value)), height));
+  }
+
+  Value concat(const VectorObj &other) const {
+    if (!root || !other.root) {
+      return Value(make_unique<VectorObj>(root ? root : other.root,
+                                          root ? height : other.height));
+    }
+    vector<VecPtr> nodes = vecMerge(root, height, other.root, other.height);
+    int top = max(height, other.height);
+    if (nodes.size() == 1) {
+      return Value(make_unique<VectorObj>(std::move(nodes[0]), top));
+    }
+    return Value(
+        make_unique<VectorObj>(vecInner(std::move(nodes), top + 1), top + 1));
+  }
 
-  explicit ListObj(vector<unique_ptr<Obj>> elems)
-      : elements(std::move(elems)) {}
+  // Elements [start, end), which must be within the vector.
+  Value slice(size_t start, size_t end) const {
+    if (start == end) {
+      return Value(make_unique<VectorObj>());
+    }
+    VecPtr kept = vecDrop(vecTake(root, height, end), height, start);
+    return Value(make_unique<VectorObj>(std::move(kept), height));
+  }
 
   string toString() const override {
-    string result = "(";
-    for (size_t i = 0; i < elements.size(); i++) {
+    string result = "#(";
+    for (size_t i = 0; i < size(); i++) {
       if (i > 0)
         result += " ";
-      result += elements[i]->toString();
+      result += at(i).toString();
     }
     result += ")";
     return result;
   }
+};
+
+// A node of the graph collectCycles traces: an object, or a vector node.
+struct HeapNode {
+  const void *address;
+  bool vector;
+};
+
+// Calls reach(node, holds) for every node that node holds directly and
+// from which a box can be reached, with the holds on it.
+template <class Reach> static void forEachHeld(HeapNode node, Reach &&reach) {
+  auto value = [&](const Value &held) {
+    if (held.mayCycle()) {
+      reach(HeapNode{held.obj(), false}, int64_t(held.obj()->refs));
+    }
+  };
+  auto child = [&](const VecPtr &held) {
+    if (held && held->mayCycle) {
+      reach(HeapNode{held.get(), true}, int64_t(held.use_count()));
+    }
+  };
+  if (node.vector) {
+    auto *vec = static_cast<const VecNode *>(node.address);
+    for_each(vec->items.begin(), vec->items.end(), value);
+    for_each(vec->children.begin(), vec->children.end(), child);
+    return;
+  }
+  auto *object = static_cast<const Obj *>(node.address);
+  switch (object->type) {
+  case ObjType::String:
+    break;
+  case ObjType::Lambda: {
+    const auto &captured = static_cast<const LambdaObj *>(object)->captured;
+    for_each(captured.begin(), captured.end(), value);
+    break;
+  }
+  case ObjType::List:
+    value(static_cast<const ListObj *>(object)->first);
+    value(static_cast<const ListObj *>(object)->rest);
+    break;
+  case ObjType::Box:
+    value(static_cast<const BoxObj *>(object)->value);
+    break;
+  case ObjType::Vector:
+    child(static_cast<const VectorObj *>(object)->root);
+    break;
+  }
+}
+
+// Traces everything reachable from the suspects that can reach a box. A
+// node held more often than the traced nodes account for is held from
+// outside, and so is all it reaches; the rest is garbage, kept alive only
+// by cycles among itself. Emptying its boxes breaks those cycles, and
+// counting frees the rest. The next collection waits for twice as many
+// suspects as this one found alive, so tracing what stays alive costs a
+// bounded amount per suspect.
+void ObjHeap::collectCycles() {
+  enum : uint8_t { Untraced, Traced, Outside };
+  vector<Obj *> roots;
+  roots.swap(suspects);
+  // While tracing, a traced object's refs count only the holds that no
+  // traced node accounts for. A vector node has no count to spare, so
+  // its own lives here.
+  struct VecState {
+    int64_t holds;
+    bool outside = false;
+  };
+  unordered_map<const void *, VecState> vectors;
+  auto object = [](HeapNode node) {
+    return static_cast<Obj *>(const_cast<void *>(node.address));
+  };
+  vector<HeapNode> nodes, stack;
+  auto reach = [&](HeapNode node, int64_t holds) {
+    bool added;
+    if (node.vector) {
+      auto [it, inserted] = vectors.try_emplace(node.address, VecState{holds});
+      it->second.holds--;
+      added = inserted;
+    } else {
+      object(node)->refs--;
+      added = exchange(object(node)->mark, Traced) == Untraced;
+    }
+    if (added) {
+      stack.push_back(node);
+    }
+  };
+  for (Obj *root : roots) {
+    reach(HeapNode{root, false}, 0); // Its hold as a suspect
+  }
+  while (!stack.empty()) {
+    HeapNode node = stack.back();
+    stack.pop_back();
+    nodes.push_back(node);
+    forEachHeld(node, reach);
+  }
+
+  auto markOutside = [&](HeapNode node) {
+    if (node.vector) {
+      return !exchange(vectors[node.address].outside, true);
+    }
+    return exchange(object(node)->mark, Outside) != Outside;
+  };
+  for (HeapNode node : nodes) {
+    int64_t holds =
+        node.vector ? vectors[node.address].holds : object(node)->refs;
+    if (holds > 0 && markOutside(node)) {
+      stack.push_back(node);
+    }
+  }
+  size_t live = 0;
+  while (!stack.empty()) {
+    HeapNode node = stack.back();
+    stack.pop_back();
+    live++;
+    forEachHeld(node, [&](HeapNode held, int64_t) {
+      if (markOutside(held)) {
+        stack.push_back(held);
+      }
+    });
+  }
+  collectAt = max(minCollect, 2 * live);
 
-  unique_ptr<Obj> clone() const override {
-    vector<unique_ptr<Obj>> newElements;
-    for (const auto &elem : elements) {
-      newElements.push_back(elem->clone());
+  // Put the counts back, and let the suspects go.
+  for (HeapNode node : nodes) {
+    forEachHeld(node, [&](HeapNode held, int64_t) {
+      if (!held.vector) {
+        object(held)->refs++;
+      }
+    });
+  }
+  for (Obj *root : roots) {
+    root->refs++;
+    root->suspected = false;
+  }
+  // Garbage is only held by garbage, so none of it is suspected again as
+  // it goes, and the boxes are held until all of them are emptied.
+  vector<BoxObj *> boxes;
+  for (HeapNode node : nodes) {
+    if (node.vector) {
+      continue;
+    }
+    Obj *traced = object(node);
+    bool garbage = exchange(traced->mark, Untraced) != Outside;
+    if (garbage) {
+      traced->suspected = true;
+    }
+    if (garbage && traced->type == ObjType::Box) {
+      traced->refs++;
+      boxes.push_back(static_cast<BoxObj *>(traced));
     }
-    return make_unique<ListObj>(std::move(newElements));
   }
+  for (Obj *root : roots) {
+    if (--root->refs == 0) {
+      release(root);
+    }
+  }
+  for (BoxObj *box : boxes) {
+    box->value = Value();
+  }
+  for (BoxObj *box : boxes) {
+    if (--box->refs == 0) {
+      release(box);
+    }
+  }
+}
+
+// Type switch over values: calls visitor with the number, with the object
+// as its own class, or with no arguments for void.
+template <class Visitor>
+static decltype(auto) visitValue(const Value &value, Visitor &&visitor) {
+  if (value.isNumber()) {
+    return visitor(value.number());
+  }
+  Obj *object = value.obj();
+  if (!object) {
+    return visitor();
+  }
+  switch (object->type) {
+  case ObjType::String:
+    return visitor(*static_cast<StringObj *>(object));
+  case ObjType::Lambda:
+    return visitor(*static_cast<LambdaObj *>(object));
+  case ObjType::List:
+    return visitor(*static_cast<ListObj *>(object));
+  case ObjType::Box:
+    return visitValue(static_cast<BoxObj *>(object)->value, visitor);
+  case ObjType::Vector:
+    break;
+  }
+  return visitor(*static_cast<VectorObj *>(object));
+}
+
+template <class... Fns> struct Overloaded : Fns... {
+  using Fns::operator()...;
 };
+template <class... Fns> Overloaded(Fns...) -> Overloaded<Fns...>;
 
-class Env {
-private:
-  unordered_map<string_view, unique_ptr<Obj>> values; // Changed to string_view
-  Env *parent;
-  vector<string> storage; // Storage for string lifetime management
+string Value::toString() const {
+  auto number = [](double number) { return to_string(number); };
+  auto object = [](const Obj &object) { return object.toString(); };
+  auto none = []() { return string(); };
+  return visitValue(*this, Overloaded{number, object, none});
+}
 
-public:
-  explicit Env(Env *p = nullptr) : parent(p) {}
+// Symbols: every identifier is interned once per session to a small
+// integer, so bindings are keyed, looked up and compared as integers.
+using Symbol = uint32_t;
+static constexpr Symbol noSymbol = UINT32_MAX;
+
+// Names the reader treats specially. Their position is their symbol:
+// special forms in NodeKind order, then the operators, then the compound
+// assignments.
+static constexpr string_view builtinNames[] = {
+    "define", "begin", "display", "if",  "while", "lambda", "let", "set!",
+    "eval",   "list",  "get",     "car", "cdr",   "cons",   "len", "toString",
+    "vector", "push",  "set-nth", "concat", "slice",
+    "+",      "-",     "*",       "/",   "==",    "!=",
+    "+=",     "-=",    "*=",      "/="};
+
+// Builtin names are found through a perfect hash whose seed is searched at
+// compile time: the first one that puts every name in its own bucket.
+static constexpr int builtinBits = 7;
+static constexpr size_t builtinBuckets = size_t(1) << builtinBits;
+
+static constexpr uint32_t builtinHash(string_view name, uint32_t seed) {
+  uint32_t hash = 2166136261u;
+  for (char c : name) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+  }
+  return ((hash ^ seed) * 0x9E3779B1u) >> (32 - builtinBits);
+}
+
+static constexpr uint32_t findBuiltinSeed() {
+  for (uint32_t seed = 0;; seed++) {
+    bool used[builtinBuckets] = {};
+    bool perfect = true;
+    for (string_view name : builtinNames) {
+      uint32_t bucket = builtinHash(name, seed);
+      perfect = perfect && !used[bucket];
+      used[bucket] = true;
+    }
+    if (perfect) {
+      return seed;
+    }
+  }
+}
+
+static constexpr uint32_t builtinSeed = findBuiltinSeed();
+
+struct BuiltinTable {
+  uint8_t buckets[builtinBuckets] = {}; // Symbol + 1, or 0 when empty
+};
+
+static constexpr BuiltinTable makeBuiltinTable() {
+  BuiltinTable table;
+  for (size_t i = 0; i < size(builtinNames); i++) {
+    table.buckets[builtinHash(builtinNames[i], builtinSeed)] = i + 1;
+  }
+  return table;
+}
+
+static constexpr BuiltinTable builtinTable = makeBuiltinTable();
+
+// The fixed symbol of a builtin name, or noSymbol.
+static constexpr Symbol builtinSymbol(string_view name) {
+  uint8_t entry = builtinTable.buckets[builtinHash(name, builtinSeed)];
+  return entry && builtinNames[entry - 1] == name ? entry - 1 : noSymbol;
+}
+
+static constexpr Symbol firstOperator = builtinSymbol("+");
+static constexpr Symbol firstCompoundAssign = builtinSymbol("+=");
+static constexpr Symbol divAssign = builtinSymbol("/=");
+static_assert(builtinSymbol("define") == 0 && builtinSymbol("x") == noSymbol);
+
+// An open-addressing table from names to symbols. Readers on worker
+// threads intern too, hence the lock. Builtin names are interned first so
+// that their symbols are their fixed IDs.
+class SymbolTable {
+public:
+  SymbolTable() {
+    for (string_view name : builtinNames) {
+      intern(name);
+    }
+  }
+
+  Symbol intern(string_view name) {
+    lock_guard<mutex> lock(guard);
+    size_t hash = std::hash<string_view>()(name);
+    Symbol &bucket = buckets[probe(name, hash)];
+    if (bucket != noSymbol) {
+      return bucket;
+    }
+    bucket = static_cast<Symbol>(names.size());
+    names.emplace_back(name);
+    hashes.push_back(hash);
+    if (names.size() * 2 > buckets.size()) {
+      grow();
+    }
+    return static_cast<Symbol>(names.size() - 1);
+  }
+
+  // The symbol of a name, or noSymbol if it was never interned.
+  Symbol find(string_view name) {
+    lock_guard<mutex> lock(guard);
+    return buckets[probe(name, std::hash<string_view>()(name))];
+  }
+
+  string_view name(Symbol symbol) {
+    lock_guard<mutex> lock(guard);
+    return names[symbol];
+  }
+
+private:
+  mutex guard;
+  deque<string> names; // By symbol
+  vector<size_t> hashes;
+  vector<Symbol> buckets = vector<Symbol>(256, noSymbol);
+
+  // The bucket holding name, or the empty one where it belongs.
+  size_t probe(string_view name, size_t hash) const {
+    size_t mask = buckets.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      Symbol symbol = buckets[i];
+      if (symbol == noSymbol ||
+          (hashes[symbol] == hash && names[symbol] == name)) {
+        return i;
+      }
+    }
+  }
+
+  void grow() {
+    buckets.assign(buckets.size() * 2, noSymbol);
+    size_t mask = buckets.size() - 1;
+    for (Symbol symbol = 0; symbol < names.size(); symbol++) {
+      size_t i = hashes[symbol] & mask;
+      while (buckets[i] != noSymbol) {
+        i = (i + 1) & mask;
+      }
+      buckets[i] = symbol;
+    }
+  }
+};
+
+static SymbolTable symbolTable;
+
+// How a frame slot starts: empty, with a box, and for the slot of a define,
+// unbound until the define runs.
+enum SlotStart : uint8_t { Plain = 0, Boxed = 1, Unbound = 2 };
+
+class Env {
+private:
+  unordered_map<Symbol, Value> values;
+  Env *parent;
+  // Lambda parameters and let bindings, by position. A repeated name is
+  // bound by its last slot, as it was when each one overwrote the map.
+  // Frames with a few slots, as most calls and lets have, keep them inside
+  // the Env itself, so making one allocates nothing.
+  static constexpr size_t inlineSize = 4;
+  const vector<Symbol> *slotNames = nullptr;
+  size_t slotCount = 0;
+  Value inlineSlots[inlineSize];
+  unique_ptr<Value[]> heapSlots;
+  Value *slots = inlineSlots;
+
+  // The variable a slot holds: the slot itself, or the box in it.
+  static Value &open(Value &cell) {
+    if (auto *box = cell.as<BoxObj>()) [[unlikely]] {
+      return box->value;
+    }
+    return cell;
+  }
+
+  Value *localCell(Symbol name) const {
+    if (slotNames) {
+      for (size_t i = slotCount; i-- > 0;) {
+        if ((*slotNames)[i] == name) {
+          return &slots[i];
+        }
+      }
+    }
+    auto it = values.find(name);
+    return it != values.end() ? const_cast<Value *>(&it->second) : nullptr;
+  }
+
+  // A define's slot is no binding until the define runs.
+  const Value *local(Symbol name) const {
+    Value *cell = localCell(name);
+    if (!cell || open(*cell).isUnbound()) {
+      return nullptr;
+    }
+    return &open(*cell);
+  }
+
+  Value *local(Symbol name) {
+    return const_cast<Value *>(as_const(*this).local(name));
+  }
+
+  // Takes the slots of other, which is left without any.
+  void takeSlots(Env &other) {
+    slotNames = exchange(other.slotNames, nullptr);
+    slotCount = exchange(other.slotCount, 0);
+    heapSlots = std::move(other.heapSlots);
+    for (size_t i = 0; i < inlineSize; i++) {
+      inlineSlots[i] = std::move(other.inlineSlots[i]);
+    }
+    slots = heapSlots ? heapSlots.get() : inlineSlots;
+    other.slots = other.inlineSlots;
+  }
+
+  Env *up(int depth) {
+    Env *env = this;
+    while (depth-- > 0) {
+      env = env->parent;
+    }
+    return env;
+  }
+
+  // The binding the name of slot i has outside this frame.
+  __attribute__((noinline)) Value &outside(size_t i) {
+    Symbol name = (*slotNames)[i];
+    if (Value *binding = parent ? parent->find(name) : nullptr) {
+      return *binding;
+    }
+    throw runtime_error("Undefined variable: " +
+                        string(symbolTable.name(name)));
+  }
+
+public:
+  explicit Env(Env *p = nullptr) : parent(p) {}
+
+  // A frame with a slot for each name, each starting as starts says;
+  // slots past its end start empty.
+  Env(Env *p, const vector<Symbol> &names, const vector<uint8_t> &starts)
+      : parent(p), slotNames(&names), slotCount(names.size()) {
+    if (slotCount > inlineSize) {
+      heapSlots = make_unique<Value[]>(slotCount);
+      slots = heapSlots.get();
+    }
+    for (size_t i = 0; i < starts.size(); i++) {
+      Value start = starts[i] & Unbound ? Value::unbound() : Value();
+      if (starts[i] & Boxed) {
+        start = Value(make_unique<BoxObj>(std::move(start)));
+      }
+      slots[i] = std::move(start);
+    }
+  }
+
+  Env(const Env &) = delete;
+  Env &operator=(const Env &) = delete;
+
+  Env(Env &&other) noexcept
+      : values(std::move(other.values)), parent(other.parent) {
+    takeSlots(other);
+  }
+
+  Env &operator=(Env &&other) noexcept {
+    if (this != &other) {
+      values = std::move(other.values);
+      parent = other.parent;
+      takeSlots(other);
+    }
+    return *this;
+  }
+
+  bool contains(Symbol name) const {
+    return local(name) || (parent && parent->contains(name));
+  }
+
+  bool containsLocal(Symbol name) const { return local(name); }
+
+  const Value *get(Symbol name) const {
+    if (auto binding = local(name)) {
+      return binding;
+    }
+    return parent ? parent->get(name) : nullptr;
+  }
+
+  void set(Symbol name, Value value) {
+    if (auto cell = localCell(name)) {
+      open(*cell) = std::move(value);
+      return;
+    }
+    values.emplace(name, std::move(value));
+  }
+
+  // Slot i of a frame built from a name list.
+  Value &slot(size_t i) { return open(slots[i]); }
+
+  // The global scope, where every lambda body runs.
+  Env &global() {
+    Env *env = this;
+    while (env->parent) {
+      env = env->parent;
+    }
+    return *env;
+  }
+
+  // The slot at a lexical address: depth frames up, then by position. A
+  // define's slot stands for what its name means outside the frame until
+  // the define runs.
+  Value &at(int depth, int i) {
+    Env *env = up(depth);
+    Value &value = open(env->slots[i]);
+    if (value.isUnbound()) [[unlikely]] {
+      return env->outside(i);
+    }
+    return value;
+  }
+
+  // Like at, but a shared variable's box rather than what it holds.
+  Value &cell(int depth, int i) { return up(depth)->slots[i]; }
+
+  // Like find, but a shared variable's box rather than what it holds.
+  Value *findCell(Symbol name) {
+    if (auto binding = localCell(name)) {
+      return binding;
+    }
+    return parent ? parent->findCell(name) : nullptr;
+  }
+
+  // The binding itself, so callers can read or update it in place.
+  Value *find(Symbol name) {
+    if (auto binding = local(name)) {
+      return binding;
+    }
+    return parent ? parent->find(name) : nullptr;
+  }
+
+  bool setExisting(Symbol name, Value value) {
+    if (auto binding = local(name)) {
+      *binding = std::move(value);
+      return true;
+    }
+    return parent ? parent->setExisting(name, std::move(value)) : false;
+  }
+
+  Env *findDefiningScope(Symbol name) {
+    if (local(name)) {
+      return this;
+    }
+    return parent ? parent->findDefiningScope(name) : nullptr;
+  }
+
+  // By name, for callers that hold no symbol. A name that was never
+  // interned can't be bound.
+  const Value *get(string_view name) const {
+    return get(symbolTable.find(name));
+  }
+  void set(string_view name, Value value) {
+    set(symbolTable.intern(name), std::move(value));
+  }
+  Value *find(string_view name) {
+    return find(symbolTable.find(name));
+  }
+  bool setExisting(string_view name, Value value) {
+    return setExisting(symbolTable.find(name), std::move(value));
+  }
+  Env *findDefiningScope(string_view name) {
+    return findDefiningScope(symbolTable.find(name));
+  }
+};
+
+// Structural index: the whole buffer is classified up front, 64 bytes at a
+// time with SIMD compares, into bit masks of whitespace, delimiters and
+// quotes. Tokens are then cut by scanning those masks a word at a time and
+// parens are matched in the same pass, so the reader never looks at single
+// characters to find where a token or a list ends.
+//
+// Tokens follow the original tokenizer: parens and a leading quote are
+// single-character tokens, anything else runs to whitespace, a paren or a
+// backtick, and a backtick where a token would start ends the input. A
+// string literal is kept as one token from its opening to its closing quote.
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CPPLISP_SIMD_INDEX 1
+#endif
+
+struct BlockMasks {
+  uint64_t space = 0, delimiter = 0, quote = 0;
+};
+
+static void classifyScalar(const char *block, BlockMasks &masks) {
+  for (int i = 0; i < 64; i++) {
+    unsigned char c = block[i];
+    uint64_t bit = uint64_t(1) << i;
+    bool space = c == ' ' || (c >= '\t' && c <= '\r');
+    if (space || c == '(' || c == ')' || c == '`') {
+      masks.delimiter |= bit;
+    }
+    if (space) {
+      masks.space |= bit;
+    }
+    if (c == '"') {
+      masks.quote |= bit;
+    }
+  }
+}
+
+#ifdef CPPLISP_SIMD_INDEX
+
+static void classifySse2(const char *block, BlockMasks &masks) {
+  for (int i = 0; i < 4; i++) {
+    __m128i c =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16 * i));
+    // '\t'..'\r' are the bytes whose distance from '\t' is at most 4
+    __m128i fromTab = _mm_sub_epi8(c, _mm_set1_epi8('\t'));
+    __m128i space = _mm_or_si128(
+        _mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+        _mm_cmpeq_epi8(_mm_min_epu8(fromTab, _mm_set1_epi8(4)), fromTab));
+    __m128i delimiter = _mm_or_si128(
+        _mm_or_si128(space, _mm_cmpeq_epi8(c, _mm_set1_epi8('`'))),
+        _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('(')),
+                     _mm_cmpeq_epi8(c, _mm_set1_epi8(')'))));
+    __m128i quote = _mm_cmpeq_epi8(c, _mm_set1_epi8('"'));
+    int shift = 16 * i;
+    masks.space |= uint64_t(uint16_t(_mm_movemask_epi8(space))) << shift;
+    masks.delimiter |= uint64_t(uint16_t(_mm_movemask_epi8(delimiter)))
+                       << shift;
+    masks.quote |= uint64_t(uint16_t(_mm_movemask_epi8(quote))) << shift;
+  }
+}
+
+__attribute__((target("avx2"))) static void
+classifyAvx2(const char *block, BlockMasks &masks) {
+  for (int i = 0; i < 2; i++) {
+    __m256i c =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + 32 * i));
+    __m256i fromTab = _mm256_sub_epi8(c, _mm256_set1_epi8('\t'));
+    __m256i space = _mm256_or_si256(
+        _mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(fromTab, _mm256_set1_epi8(4)),
+                          fromTab));
+    __m256i delimiter = _mm256_or_si256(
+        _mm256_or_si256(space, _mm256_cmpeq_epi8(c, _mm256_set1_epi8('`'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('(')),
+                        _mm256_cmpeq_epi8(c, _mm256_set1_epi8(')'))));
+    __m256i quote = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('"'));
+    int shift = 32 * i;
+    masks.space |= uint64_t(uint32_t(_mm256_movemask_epi8(space))) << shift;
+    masks.delimiter |= uint64_t(uint32_t(_mm256_movemask_epi8(delimiter)))
+                       << shift;
+    masks.quote |= uint64_t(uint32_t(_mm256_movemask_epi8(quote))) << shift;
+  }
+}
+
+#endif
+
+class SourceIndex {
+public:
+  static constexpr uint32_t none = UINT32_MAX;
+
+  struct Token {
+    uint32_t start, length;
+    uint32_t match = none; // Index of the matching paren token
+  };
+
+  vector<Token> tokens;
+
+  explicit SourceIndex(string_view source) : source(source) {
+    if (source.size() >= none) {
+      throw runtime_error("Source too large");
+    }
+    classify();
+    cut();
+  }
+
+private:
+  string_view source;
+  // starts marks every byte that can begin a token: parens, backticks and
+  // the first byte after a delimiter. Bytes inside strings are filtered out
+  // while cutting, since only a quote that begins a token opens a string.
+  vector<uint64_t> starts, delimiter, quote;
+  size_t candidates = 0;
+
+  void classify() {
+    void (*classifyBlock)(const char *, BlockMasks &) = classifyScalar;
+#ifdef CPPLISP_SIMD_INDEX
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    classifyBlock = avx2 ? classifyAvx2 : classifySse2;
+#endif
+    size_t blocks = (source.size() + 63) / 64;
+    starts.resize(blocks);
+    delimiter.resize(blocks);
+    quote.resize(blocks);
+    uint64_t carry = 1; // The start of the buffer acts as a delimiter
+    for (size_t i = 0; i < blocks; i++) {
+      BlockMasks masks;
+      if (64 * i + 64 <= source.size()) {
+        classifyBlock(source.data() + 64 * i, masks);
+      } else {
+        char tail[64] = {};
+        memcpy(tail, source.data() + 64 * i, source.size() - 64 * i);
+        classifyBlock(tail, masks);
+      }
+      uint64_t afterDelimiter = masks.delimiter << 1 | carry;
+      carry = masks.delimiter >> 63;
+      starts[i] = (~masks.delimiter & afterDelimiter) |
+                  (masks.delimiter & ~masks.space);
+      delimiter[i] = masks.delimiter;
+      quote[i] = masks.quote;
+      candidates += __builtin_popcountll(starts[i]);
+    }
+  }
+
+  // First position after from whose bit is set in mask, or the size.
+  size_t next(const vector<uint64_t> &mask, size_t from) const {
+    size_t block = from / 64;
+    uint64_t bits = mask[block] & (~uint64_t(0) << (from % 64));
+    while (!bits) {
+      if (++block == mask.size()) {
+        return source.size();
+      }
+      bits = mask[block];
+    }
+    return min(source.size(), 64 * block + __builtin_ctzll(bits));
+  }
+
+  // Cuts the token starting at pos and returns where it ends.
+  size_t token(size_t pos, vector<uint32_t> &open) {
+    size_t end = pos + 1;
+    uint32_t match = none;
+    if (source[pos] == '(') {
+      open.push_back(tokens.size());
+    } else if (source[pos] == ')') {
+      if (!open.empty()) {
+        match = open.back();
+        tokens[match].match = tokens.size();
+        open.pop_back();
+      }
+    } else if (source[pos] == '"') {
+      if (end < source.size()) {
+        end = min(source.size(), next(quote, end) + 1);
+      }
+    } else {
+      end = next(delimiter, pos);
+    }
+    tokens.push_back({static_cast<uint32_t>(pos),
+                      static_cast<uint32_t>(end - pos), match});
+    return end;
+  }
+
+  void cut() {
+    tokens.reserve(candidates);
+    vector<uint32_t> open;
+    size_t end = 0; // End of the last token
+    for (size_t block = 0; block < starts.size(); block++) {
+      for (uint64_t bits = starts[block]; bits; bits &= bits - 1) {
+        size_t pos = 64 * block + __builtin_ctzll(bits);
+        if (pos < end) {
+          continue; // inside a string literal
+        }
+        if (pos >= source.size() || source[pos] == '`') {
+          return;
+        }
+        end = token(pos, open);
+        // A token glued to a closing quote has no start bit of its own.
+        while (source[end - 1] == '"' && end - pos > 1 &&
+               end < source.size() && !(delimiter[end / 64] >> end % 64 & 1)) {
+          pos = end;
+          end = token(pos, open);
+        }
+      }
+    }
+  }
+};
+
+// The reader turns source text into a tree once: literals are decoded and
+// every form head is resolved to its kind, so evaluation never looks at text.
+enum class NodeKind {
+  Number,
+  String,
+  Symbol,
+  Apply,
+  Operator,
+  CompoundAssign,
+  Define,
+  Begin,
+  Display,
+  If,
+  While,
+  Lambda,
+  Let,
+  Set,
+  Eval,
+  List,
+  Get,
+  Car,
+  Cdr,
+  Cons,
+  Len,
+  ToString,
+  Vector,
+  Push,
+  SetNth,
+  Concat,
+  Slice,
+  // Fused by the reader from a list builtin applied to list or cons; see
+  // fuseListBuiltin. They have no names of their own.
+  LenOfList,
+  CarOfList,
+  LenOfCons,
+  CarOfCons,
+  CdrOfCons
+};
+
+struct Node {
+  NodeKind kind;
+  double number = 0;            // Number literal
+  string_view text;             // Symbol, string literal, operator or name
+  string_view source;           // Body text of a lambda, used for printing
+  const BinaryOp *op = nullptr; // Operator and compound assignment
+  vector<string_view> names;    // Lambda parameters and let bindings
+  vector<Symbol> nameSymbols;   // The same, interned; a lambda's captured
+                                // variables follow its parameters
+  Symbol symbol = noSymbol;     // Interned text of a Symbol, Define or Set,
+                                // builtin symbol of an operator
+  vector<NodePtr> children;
+  vector<NodePtr> captures; // Lambda: its captured variables, as references
+                            // in the scope that makes it
+  vector<uint8_t> starts; // Lambda and let: how each slot starts, as
+                          // SlotStart bits
+  // Lexical address of a variable reference or set!, or -1 when the name
+  // has to be looked up at run time.
+  int depth = -1, slot = -1;
+
+  explicit Node(NodeKind kind) : kind(kind) {}
+};
+
+// The binding a Symbol or Set node refers to.
+static Value *findBinding(Env &env, const Node &node) {
+  return node.slot >= 0 ? &env.at(node.depth, node.slot)
+                        : env.find(node.symbol);
+}
+
+// Binds the captured variables in a new frame for lambda. They are its
+// last slots.
+static void bindCaptures(Env &frame, const LambdaObj &lambda) {
+  size_t first = lambda.def->nameSymbols.size() - lambda.captured.size();
+  for (size_t i = 0; i < lambda.captured.size(); i++) {
+    frame.slot(first + i) = lambda.captured[i];
+  }
+}
+
+// A call frame for a lambda. Scoping is lexical: the body sees its
+// parameters, the variables it captured and the globals, never its caller.
+static Env callFrame(Env &env, const LambdaObj &lambda) {
+  Env frame(&env.global(), lambda.def->nameSymbols, lambda.def->starts);
+  bindCaptures(frame, lambda);
+  return frame;
+}
+
+// Makes the lambda a Lambda node evaluates to in env. A captured variable
+// that is assigned is captured as its box, shared with the frame.
+static Value makeLambda(Env &env, const Node &node) {
+  vector<Value> captured;
+  captured.reserve(node.captures.size());
+  for (const auto &ref : node.captures) {
+    Value *cell = ref->slot >= 0 ? &env.cell(ref->depth, ref->slot)
+                                 : env.findCell(ref->symbol);
+    if (!cell) {
+      throw runtime_error("Undefined variable: " + string(ref->text));
+    }
+    captured.push_back(*cell);
+  }
+  return Value(make_unique<LambdaObj>(&node, std::move(captured)));
+}
+
+// Resolves variables bound by an enclosing lambda or let to the frame and
+// slot that holds them. A define in the body of a lambda or let gets a slot
+// after its parameters or bindings; until the define runs, the name still
+// means what it does outside. A lambda that uses any of these from outside
+// itself captures it: the name becomes an extra slot of its frame, copied
+// from the enclosing scope when the lambda is made. A captured slot that is
+// also assigned or defined, inside the lambda or out, is boxed so the
+// copies share it. A lookup that passes a frame with eval, which may bind
+// the name at run time, stays by name; so do globals.
+class Resolver {
+public:
+  void resolve(Node &node) {
+    switch (node.kind) {
+    case NodeKind::Symbol:
+      address(node, node.symbol);
+      return;
+    case NodeKind::Define:
+    case NodeKind::Set:
+      address(node, node.symbol, Assigned);
+      break;
+    case NodeKind::CompoundAssign:
+      address(*node.children[0], node.children[0]->symbol, Assigned);
+      resolve(*node.children[1]);
+      return;
+    case NodeKind::Lambda:
+      enter(node, 0, true);
+      return;
+    case NodeKind::Let:
+      for (size_t i = 0; i < node.names.size(); i++) {
+        resolve(*node.children[i]);
+      }
+      enter(node, node.names.size(), false);
+      return;
+    default:
+      break;
+    }
+    for (auto &child : node.children) {
+      resolve(*child);
+    }
+  }
+
+private:
+  // What a reference does to its slot, as bits.
+  enum Use { Read = 0, Assigned = 1, Captured = 2 };
+
+  struct Frame {
+    const vector<Symbol> *names;
+    Node *lambda; // The lambda form, or null for a let
+    bool evals = false;
+    unordered_set<Symbol> defines;
+    vector<uint8_t> uses; // Of each slot, the Use bits seen
+  };
+
+  vector<Frame> frames;
+
+  // Resolves the body of a lambda or let, children [first, end).
+  void enter(Node &node, size_t first, bool lambda) {
+    Frame frame{&node.nameSymbols, lambda ? &node : nullptr, false, {}, {}};
+    for (size_t i = first; i < node.children.size(); i++) {
+      scan(*node.children[i], frame);
+    }
+    size_t defines = node.nameSymbols.size();
+    for (Symbol name : frame.defines) {
+      if (slotOf(frame, name) < 0) {
+        node.nameSymbols.push_back(name);
+      }
+    }
+    size_t own = node.nameSymbols.size();
+    if (defines < own) {
+      node.starts.resize(own, Plain);
+      fill(node.starts.begin() + defines, node.starts.end(), Unbound);
+    }
+    frames.push_back(std::move(frame));
+    for (size_t i = first; i < node.children.size(); i++) {
+      resolve(*node.children[i]);
+    }
+    vector<uint8_t> uses = std::move(frames.back().uses);
+    frames.pop_back();
+    uses.resize(node.nameSymbols.size(), Read);
+    for (size_t i = 0; i < own; i++) {
+      if (uses[i] == (Assigned | Captured)) {
+        node.starts.resize(own, Plain);
+        node.starts[i] |= Boxed;
+      }
+    }
+    // Captures are read where the lambda is made, which may capture them
+    // in turn into an enclosing lambda.
+    for (size_t i = 0; i < node.captures.size(); i++) {
+      Node &capture = *node.captures[i];
+      address(capture, capture.symbol, Captured | (uses[own + i] & Assigned));
+    }
+  }
+
+  // Notes the defines and evals that run directly in a frame.
+  static void scan(const Node &node, Frame &frame) {
+    size_t end = node.children.size();
+    switch (node.kind) {
+    case NodeKind::Lambda:
+      return;
+    case NodeKind::Let:
+      end = node.names.size();
+      break;
+    case NodeKind::Define:
+      frame.defines.insert(node.symbol);
+      break;
+    case NodeKind::Eval:
+      frame.evals = true;
+      break;
+    default:
+      break;
+    }
+    for (size_t i = 0; i < end; i++) {
+      scan(*node.children[i], frame);
+    }
+  }
+
+  static int slotOf(const Frame &frame, Symbol name) {
+    const vector<Symbol> &names = *frame.names;
+    for (size_t i = names.size(); i-- > 0;) {
+      if (names[i] == name) {
+        return int(i);
+      }
+    }
+    return -1;
+  }
+
+  void address(Node &node, Symbol name, int use = Read) {
+    bool dynamic = false;
+    for (size_t up = 0; up < frames.size(); up++) {
+      size_t index = frames.size() - 1 - up;
+      Frame &frame = frames[index];
+      int slot = slotOf(frame, name);
+      if (slot < 0 && frame.lambda) {
+        if (!boundOutside(index, name)) {
+          return;
+        }
+        slot = capture(*frame.lambda, name, node.text);
+      }
+      if (slot >= 0) {
+        if (frame.uses.size() <= size_t(slot)) {
+          frame.uses.resize(slot + 1, Read);
+        }
+        frame.uses[slot] |= use;
+        if (!dynamic) {
+          node.depth = int(up);
+          node.slot = slot;
+        }
+        return;
+      }
+      dynamic = dynamic || frame.evals;
+    }
+  }
+
+  // Whether a frame outside frames[index] has a slot for the name.
+  bool boundOutside(size_t index, Symbol name) const {
+    for (size_t i = 0; i < index; i++) {
+      if (slotOf(frames[i], name) >= 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static int capture(Node &lambda, Symbol name, string_view text) {
+    auto reference = make_unique<Node>(NodeKind::Symbol);
+    reference->text = text;
+    reference->symbol = name;
+    lambda.captures.push_back(std::move(reference));
+    lambda.nameSymbols.push_back(name);
+    return int(lambda.nameSymbols.size() - 1);
+  }
+};
+
+// Special forms are the first builtin symbols, in NodeKind order.
+static NodeKind specialForm(Symbol builtin) {
+  static_assert(static_cast<Symbol>(NodeKind::Slice) -
+                    static_cast<Symbol>(NodeKind::Define) + 1 ==
+                firstOperator);
+  return static_cast<NodeKind>(static_cast<Symbol>(NodeKind::Define) +
+                               builtin);
+}
+
+// Parsed forms live for the whole session: lambdas and string literals keep
+// pointers into them, just like the REPL keeps every input line alive.
+static vector<NodePtr> formStorage;
+
+class Reader {
+public:
+  explicit Reader(string_view source)
+      : Reader(source, make_shared<const SourceIndex>(source), 0, SIZE_MAX) {}
+
+  // Reads the forms among tokens [first, last) of an existing index.
+  Reader(string_view source, shared_ptr<const SourceIndex> index,
+         size_t first, size_t last)
+      : source(source), index(std::move(index)), current(first),
+        end(min(last, this->index->tokens.size())) {}
+
+  // Returns the next top-level form, or nullptr at the end of the input.
+  const Node *read() {
+    NodePtr form = readNext();
+    if (!form) {
+      return nullptr;
+    }
+    formStorage.push_back(std::move(form));
+    return formStorage.back().get();
+  }
+
+  // Like read, but leaves the form to the caller.
+  NodePtr readNext() {
+    if (current == end) {
+      return nullptr;
+    }
+    NodePtr form = readForm(nextToken());
+    Resolver().resolve(*form);
+    return form;
+  }
+
+private:
+  string_view source;
+  shared_ptr<const SourceIndex> index;
+  size_t current; // Next token
+  size_t end;
+  size_t pos = 0; // End of the last token read
+
+  string_view nextToken() {
+    if (current == end) {
+      throw runtime_error("Unmatched parentheses");
+    }
+    SourceIndex::Token token = index->tokens[current++];
+    pos = token.start + token.length;
+    return source.substr(token.start, token.length);
+  }
+
+  // String literals are reported by their opening quote.
+  static string quoteToken(string_view token) {
+    return string(token[0] == '"' ? token.substr(0, 1) : token);
+  }
+
+  string_view readName() {
+    string_view token = nextToken();
+    if (token == "(" || token == ")" || token[0] == '"') {
+      throw runtime_error("Expected a name but got " + quoteToken(token));
+    }
+    return token;
+  }
+
+  void expect(string_view expected) {
+    string_view token = nextToken();
+    if (token != expected) {
+      throw runtime_error("Expected " + string(expected) + " but got " +
+                          quoteToken(token));
+    }
+  }
+
+  NodePtr readForm(string_view token) {
+    if (token == "(") {
+      return readList();
+    }
+    if (token == ")") {
+      throw runtime_error("Unexpected )");
+    }
+
+    if (token[0] == '"') {
+      if (token.size() < 2 || token.back() != '"') {
+        throw runtime_error("Unterminated string");
+      }
+      auto node = make_unique<Node>(NodeKind::String);
+      node->text = token.substr(1, token.size() - 2);
+      return node;
+    }
+
+    if (isdigit(token[0]) || (token[0] == '-' && token.length() > 1)) {
+      auto node = make_unique<Node>(NodeKind::Number);
+      try {
+        node->number = stod(string(token));
+      } catch (const invalid_argument &) {
+        throw runtime_error("Invalid number: " + string(token));
+      }
+      return node;
+    }
+
+    auto node = make_unique<Node>(NodeKind::Symbol);
+    node->text = token;
+    node->symbol = symbolTable.intern(token);
+    return node;
+  }
+
+  // Reads the remaining expressions of a list up to its closing paren.
+  void readRest(Node &node) {
+    while (true) {
+      string_view token = nextToken();
+      if (token == ")") {
+        return;
+      }
+      node.children.push_back(readForm(token));
+    }
+  }
+
+  NodePtr readList() {
+    size_t open = current - 1;
+    string_view head = nextToken();
+    if (head == ")") {
+      throw runtime_error("Empty form ()");
+    }
+
+    Symbol builtin = builtinSymbol(head);
+    if (builtin < firstOperator) {
+      return readSpecialForm(specialForm(builtin), open);
+    }
+
+    if (builtin < firstCompoundAssign) {
+      auto node = make_unique<Node>(NodeKind::Operator);
+      node->text = head;
+      node->symbol = builtin;
+      node->op = &operators[builtin - firstOperator];
+      readRest(*node);
+      return node;
+    }
+
+    if (builtin != noSymbol) {
+      auto node = make_unique<Node>(NodeKind::CompoundAssign);
+      node->text = head;
+      node->symbol = builtin;
+      node->op = &operators[builtin - firstCompoundAssign];
+      auto target = make_unique<Node>(NodeKind::Symbol);
+      target->text = readName();
+      target->symbol = symbolTable.intern(target->text);
+      node->children.push_back(std::move(target));
+      readRest(*node);
+      if (node->children.size() != 2) {
+        throw runtime_error(string(head) + " expects a variable and a number");
+      }
+      return node;
+    }
+
+    auto node = make_unique<Node>(NodeKind::Apply);
+    node->children.push_back(readForm(head));
+    readRest(*node);
+    return node;
+  }
+
+  NodePtr readSpecialForm(NodeKind kind, size_t open) {
+    auto node = make_unique<Node>(kind);
+
+    switch (kind) {
+    case NodeKind::Define:
+    case NodeKind::Set:
+      node->text = readName();
+      node->symbol = symbolTable.intern(node->text);
+      readRest(*node);
+      if (node->children.size() != 1) {
+        throw runtime_error(string(node->text) + ": expected a single value");
+      }
+      return node;
+
+    case NodeKind::Lambda: {
+      expect("(");
+      while (true) {
+        string_view token = nextToken();
+        if (token == ")")
+          break;
+        if (token == "(" || token[0] == '"') {
+          throw runtime_error("lambda parameters must be names");
+        }
+        node->names.push_back(token);
+        node->nameSymbols.push_back(symbolTable.intern(token));
+      }
+      size_t bodyStart = pos;
+      readRest(*node);
+      size_t bodyEnd = index->tokens[index->tokens[open].match].start;
+      while (bodyStart < bodyEnd && isspace(source[bodyStart])) {
+        bodyStart++;
+      }
+      node->source = source.substr(bodyStart, bodyEnd - bodyStart);
+      return node;
+    }
+
+    case NodeKind::Let:
+      expect("(");
+      while (true) {
+        string_view token = nextToken();
+        if (token == ")")
+          break;
+        if (token == "(" || token[0] == '"') {
+          throw runtime_error("let bindings must be names");
+        }
+        node->names.push_back(token);
+        node->nameSymbols.push_back(symbolTable.intern(token));
+        node->children.push_back(readForm(nextToken()));
+      }
+      readRest(*node);
+      return node;
+
+    case NodeKind::Len:
+    case NodeKind::Car:
+    case NodeKind::Cdr:
+      readRest(*node);
+      fuseListBuiltin(*node);
+      return node;
+
+    default:
+      readRest(*node);
+      return node;
+    }
+  }
+
+  // A list builtin applied straight to the list that list or cons builds
+  // only needs the elements, so the two fuse into one builtin over them and
+  // the list is never made. The elements are still evaluated in order and
+  // the checks of both builtins still apply.
+  static void fuseListBuiltin(Node &node) {
+    if (node.children.size() != 1) {
+      return;
+    }
+    NodeKind inner = node.children[0]->kind;
+    NodeKind fused;
+    if (inner == NodeKind::List && node.kind == NodeKind::Len) {
+      fused = NodeKind::LenOfList;
+    } else if (inner == NodeKind::List && node.kind == NodeKind::Car) {
+      fused = NodeKind::CarOfList;
+    } else if (inner == NodeKind::Cons &&
+               node.children[0]->children.size() == 2) {
+      fused = node.kind == NodeKind::Len   ? NodeKind::LenOfCons
+              : node.kind == NodeKind::Car ? NodeKind::CarOfCons
+                                           : NodeKind::CdrOfCons;
+    } else {
+      return;
+    }
+    NodePtr list = std::move(node.children[0]);
+    node.kind = fused;
+    node.children = std::move(list->children);
+  }
+};
+
+// Reads a large source on several threads. A parallel prefix sum over the
+// paren depth of its tokens finds top-level form boundaries, a pool of
+// workers parses the chunks between them, and the forms are handed out in
+// source order as soon as their chunk is ready. A parse error is raised
+// only when reading reaches it, after every form before it.
+class ParallelReader {
+public:
+  ParallelReader(string_view source, unsigned threads)
+      : source(source), index(make_shared<const SourceIndex>(source)) {
+    vector<size_t> bounds = formBoundaries(threads, threads * 4);
+    chunks.resize(bounds.size() - 1);
+    for (size_t i = 0; i + 1 < bounds.size(); i++) {
+      chunks[i].first = bounds[i];
+      chunks[i].last = bounds[i + 1];
+      chunks[i].ready = chunks[i].parsed.get_future();
+    }
+    for (unsigned i = 0; i < threads; i++) {
+      workers.emplace_back([this] { work(); });
+    }
+  }
+
+  ~ParallelReader() {
+    stopped = true;
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  const Node *read() {
+    for (; current < chunks.size(); current++, nextForm = 0) {
+      Chunk &chunk = chunks[current];
+      chunk.ready.wait();
+      if (nextForm < chunk.forms.size()) {
+        formStorage.push_back(std::move(chunk.forms[nextForm++]));
+        return formStorage.back().get();
+      }
+      if (chunk.error) {
+        stopped = true;
+        rethrow_exception(chunk.error);
+      }
+    }
+    return nullptr;
+  }
+
+private:
+  struct Chunk {
+    size_t first = 0, last = 0; // Token range
+    vector<NodePtr> forms;
+    exception_ptr error;
+    promise<void> parsed;
+    future<void> ready;
+  };
+
+  string_view source;
+  shared_ptr<const SourceIndex> index;
+  vector<Chunk> chunks;
+  vector<thread> workers;
+  atomic<size_t> claimed{0};
+  atomic<bool> stopped{false};
+  size_t current = 0, nextForm = 0; // Next form to hand out
+
+  void work() {
+    size_t i;
+    while (!stopped && (i = claimed++) < chunks.size()) {
+      Chunk &chunk = chunks[i];
+      try {
+        Reader reader(source, index, chunk.first, chunk.last);
+        while (NodePtr form = reader.readNext()) {
+          chunk.forms.push_back(std::move(form));
+        }
+      } catch (...) {
+        chunk.error = current_exception();
+      }
+      chunk.parsed.set_value();
+    }
+  }
+
+  int depthChange(size_t token) const {
+    char c = source[index->tokens[token].start];
+    return c == '(' ? 1 : c == ')' ? -1 : 0;
+  }
+
+  // Token indices splitting the source into about count chunks, each
+  // starting at paren depth 0, from 0 to the number of tokens.
+  vector<size_t> formBoundaries(unsigned threads, size_t count) {
+    size_t tokens = index->tokens.size();
+    auto sliceStart = [&](size_t slice) { return slice * tokens / threads; };
+    auto parallel = [&](auto body) {
+      vector<thread> pool;
+      for (unsigned slice = 0; slice < threads; slice++) {
+        pool.emplace_back(body, slice);
+      }
+      for (auto &worker : pool) {
+        worker.join();
+      }
+    };
+
+    // Depth at the start of each slice: the sum of every earlier change.
+    vector<long> depth(threads + 1, 0);
+    parallel([&](unsigned slice) {
+      long sum = 0;
+      for (size_t i = sliceStart(slice); i < sliceStart(slice + 1); i++) {
+        sum += depthChange(i);
+      }
+      depth[slice + 1] = sum;
+    });
+    partial_sum(depth.begin(), depth.end(), depth.begin());
+
+    // Chunk c starts at the first depth-0 token at or after c * tokens /
+    // count; each slice resolves the targets that fall inside it.
+    vector<size_t> bounds(count + 1, tokens);
+    bounds[0] = 0;
+    parallel([&](unsigned slice) {
+      size_t target = 1;
+      while (target < count && target * tokens / count < sliceStart(slice)) {
+        target++;
+      }
+      long level = depth[slice];
+      size_t i = sliceStart(slice);
+      while (i < tokens && target < count) {
+        size_t goal = target * tokens / count;
+        if (goal >= sliceStart(slice + 1)) {
+          break; // a later slice's target
+        }
+        if (level == 0 && i >= goal) {
+          bounds[target++] = i;
+        } else {
+          level += depthChange(i++);
+        }
+      }
+    });
+    bounds.erase(unique(bounds.begin(), bounds.end()), bounds.end());
+    return bounds;
+  }
+};
+
+string LambdaObj::toString() const {
+  string result = "(lambda (";
+  for (size_t i = 0; i < def->names.size(); i++) {
+    if (i > 0)
+      result += " ";
+    result += string(def->names[i]);
+  }
+  result += ") ";
+  result += string(def->source);
+  result += ")";
+  return result;
+}
+
+// Method JIT: a lambda whose body only does arithmetic on its own parameters
+// is compiled to x86-64 SSE2 code once it has been called jitThreshold
+// times. The native function takes the parameters as an array of doubles,
+// keeps every intermediate in registers or its stack frame and returns the
+// result in xmm0, so a call allocates nothing. Lambdas outside that subset,
+// and calls with non-number arguments, stay on the interpreter.
+
+static bool jitEnabled = false;
+static constexpr int jitThreshold = 100;
+static constexpr size_t maxJitParams = 8;
+
+using JitCode = double (*)(double *params);
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define CPPLISP_X64_JIT 1
+#endif
+
+#ifdef CPPLISP_X64_JIT
+
+// Just enough of the x86-64 encoding for scalar double arithmetic. Memory
+// operands are always [base + disp32]; params live at rdi, temporaries at rsp.
+class X64Emitter {
+public:
+  enum Reg : uint8_t { RSP = 4, RDI = 7 };
+  enum Cond : uint8_t { JE = 0x84, JNE = 0x85, JP = 0x8A };
+
+  vector<uint8_t> code;
+
+  void bytes(initializer_list<uint8_t> values) {
+    code.insert(code.end(), values);
+  }
+
+  void imm32(uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+      code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  }
+
+  // movsd xmm, [base + disp]
+  void load(int xmm, Reg base, int32_t disp) {
+    sse(0xF2, 0x10, xmm, base, disp);
+  }
+
+  // movsd [base + disp], xmm
+  void store(Reg base, int32_t disp, int xmm) {
+    sse(0xF2, 0x11, xmm, base, disp);
+  }
+
+  // movsd xmm1, xmm0
+  void copy0to1() { bytes({0xF2, 0x0F, 0x10, 0xC8}); }
+
+  // mov rax, imm64; movq xmm, rax
+  void constant(int xmm, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof bits);
+    bytes({0x48, 0xB8});
+    imm32(static_cast<uint32_t>(bits));
+    imm32(static_cast<uint32_t>(bits >> 32));
+    bytes({0x66, 0x48, 0x0F, 0x6E, static_cast<uint8_t>(0xC0 | xmm << 3)});
+  }
+
+  // addsd/subsd/mulsd/divsd xmm0, xmm1
+  void arithmetic(uint8_t opcode) { bytes({0xF2, 0x0F, opcode, 0xC1}); }
+
+  // xmm0 = (xmm0 == xmm1) or (xmm0 != xmm1) as 1.0 or 0.0
+  void compare(bool equal) {
+    bytes({0x66, 0x0F, 0x2E, 0xC1}); // ucomisd xmm0, xmm1
+    if (equal) {
+      bytes({0x0F, 0x94, 0xC0}); // sete al
+      bytes({0x0F, 0x9B, 0xC1}); // setnp cl
+      bytes({0x20, 0xC8});       // and al, cl
+    } else {
+      bytes({0x0F, 0x95, 0xC0}); // setne al
+      bytes({0x0F, 0x9A, 0xC1}); // setp cl
+      bytes({0x08, 0xC8});       // or al, cl
+    }
+    bytes({0x0F, 0xB6, 0xC0});       // movzx eax, al
+    bytes({0xF2, 0x0F, 0x2A, 0xC0}); // cvtsi2sd xmm0, eax
+  }
+
+  // ucomisd xmm0, 0.0: ZF set and PF clear exactly when xmm0 is falsy
+  void testZero() {
+    bytes({0x66, 0x0F, 0x57, 0xC9}); // xorpd xmm1, xmm1
+    bytes({0x66, 0x0F, 0x2E, 0xC1}); // ucomisd xmm0, xmm1
+  }
+
+  size_t jump() {
+    bytes({0xE9});
+    imm32(0);
+    return code.size() - 4;
+  }
+
+  size_t jumpIf(Cond cond) {
+    bytes({0x0F, cond});
+    imm32(0);
+    return code.size() - 4;
+  }
+
+  void patch(size_t at, size_t target) {
+    uint32_t offset = static_cast<uint32_t>(target - (at + 4));
+    memcpy(&code[at], &offset, 4);
+  }
+
+  // sub rsp, imm32 with the size filled in once the frame is known
+  size_t reserveFrame() {
+    bytes({0x48, 0x81, 0xEC});
+    imm32(0);
+    return code.size() - 4;
+  }
+
+  void leave(uint32_t frame) {
+    bytes({0x48, 0x81, 0xC4}); // add rsp, imm32
+    imm32(frame);
+    bytes({0xC3}); // ret
+  }
+
+  // mov eax, status; ret
+  void exit(int32_t status) {
+    bytes({0xB8});
+    imm32(static_cast<uint32_t>(status));
+    bytes({0xC3});
+  }
+
+private:
+  void sse(uint8_t prefix, uint8_t opcode, int xmm, Reg base, int32_t disp) {
+    bytes({prefix, 0x0F, opcode, static_cast<uint8_t>(0x80 | xmm << 3 | base)});
+    if (base == RSP) {
+      bytes({0x24});
+    }
+    imm32(static_cast<uint32_t>(disp));
+  }
+};
+
+// Copies code into fresh executable pages.
+static void *installCode(const vector<uint8_t> &code) {
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t size = (code.size() + page - 1) / page * page;
+  void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+  memcpy(memory, code.data(), code.size());
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, size);
+    return nullptr;
+  }
+  return memory;
+}
+
+// Thrown while compiling a body that uses anything but numeric forms.
+struct NotJittable {};
+
+class JitCompiler {
+public:
+  explicit JitCompiler(const Node &def) : def(def) {}
+
+  JitCode compile() {
+    if (def.children.empty() || def.names.size() > maxJitParams) {
+      return nullptr;
+    }
+    try {
+      size_t frameAt = out.reserveFrame();
+      for (const auto &expr : def.children) {
+        gen(*expr);
+      }
+      uint32_t frame = static_cast<uint32_t>(maxTemps * 8);
+      memcpy(&out.code[frameAt], &frame, 4);
+      out.leave(frame);
+    } catch (const NotJittable &) {
+      return nullptr;
+    }
+    return reinterpret_cast<JitCode>(installCode(out.code));
+  }
+
+private:
+  const Node &def;
+  X64Emitter out;
+  size_t temps = 0, maxTemps = 0;
+
+  // A repeated parameter name is bound by its last slot, as in Env.
+  int32_t param(const Node &node) {
+    auto it = find(def.names.rbegin(), def.names.rend(), node.text);
+    if (it == def.names.rend()) {
+      throw NotJittable(); // a global or a captured variable
+    }
+    return static_cast<int32_t>(def.names.rend() - it - 1) * 8;
+  }
+
+  int32_t pushTemp() {
+    maxTemps = max(maxTemps, ++temps);
+    return static_cast<int32_t>(temps - 1) * 8;
+  }
+
+  void popTemp() { temps--; }
+
+  // Loads a constant or parameter straight into xmm1; false otherwise.
+  bool loadOperand(const Node &node) {
+    if (node.kind == NodeKind::Number) {
+      out.constant(1, node.number);
+      return true;
+    }
+    if (node.kind == NodeKind::Symbol) {
+      out.load(1, X64Emitter::RDI, param(node));
+      return true;
+    }
+    return false;
+  }
+
+  // xmm0 = xmm0 op xmm1
+  void apply(string_view op) {
+    if (op == "+") {
+      out.arithmetic(0x58);
+    } else if (op == "-") {
+      out.arithmetic(0x5C);
+    } else if (op == "*") {
+      out.arithmetic(0x59);
+    } else if (op == "/") {
+      out.arithmetic(0x5E);
+    } else if (op == "==") {
+      out.compare(true);
+    } else {
+      out.compare(false);
+    }
+  }
+
+  // Emits the test of xmm0 and returns the jump taken when it is falsy.
+  size_t jumpIfFalse() {
+    out.testZero();
+    size_t truthy = out.jumpIf(X64Emitter::JP);
+    size_t falsy = out.jumpIf(X64Emitter::JE);
+    out.patch(truthy, out.code.size());
+    return falsy;
+  }
+
+  // Leaves the value of node in xmm0.
+  void gen(const Node &node) {
+    switch (node.kind) {
+    case NodeKind::Number:
+      out.constant(0, node.number);
+      return;
+
+    case NodeKind::Symbol:
+      out.load(0, X64Emitter::RDI, param(node));
+      return;
+
+    case NodeKind::Operator: {
+      if (node.children.empty()) {
+        out.constant(0, 0);
+        return;
+      }
+      gen(*node.children[0]);
+      for (size_t i = 1; i < node.children.size(); i++) {
+        if (!loadOperand(*node.children[i])) {
+          int32_t temp = pushTemp();
+          out.store(X64Emitter::RSP, temp, 0);
+          gen(*node.children[i]);
+          out.copy0to1();
+          out.load(0, X64Emitter::RSP, temp);
+          popTemp();
+        }
+        apply(node.text);
+      }
+      return;
+    }
+
+    case NodeKind::Begin:
+      if (node.children.empty()) {
+        throw NotJittable(); // evaluates to Void
+      }
+      for (const auto &expr : node.children) {
+        gen(*expr);
+      }
+      return;
+
+    case NodeKind::If: {
+      if (node.children.size() < 2 || node.children.size() > 3) {
+        throw NotJittable();
+      }
+      gen(*node.children[0]);
+      size_t elseJump = jumpIfFalse();
+      gen(*node.children[1]);
+      size_t endJump = out.jump();
+      out.patch(elseJump, out.code.size());
+      if (node.children.size() == 3) {
+        gen(*node.children[2]);
+      } else {
+        out.constant(0, 0);
+      }
+      out.patch(endJump, out.code.size());
+      return;
+    }
+
+    case NodeKind::While: {
+      if (node.children.empty()) {
+        throw NotJittable();
+      }
+      int32_t lastResult = pushTemp();
+      out.constant(0, 0);
+      out.store(X64Emitter::RSP, lastResult, 0);
+      size_t loopStart = out.code.size();
+      gen(*node.children[0]);
+      size_t exitJump = jumpIfFalse();
+      for (size_t i = 1; i < node.children.size(); i++) {
+        gen(*node.children[i]);
+      }
+      if (node.children.size() > 1) {
+        out.store(X64Emitter::RSP, lastResult, 0);
+      }
+      out.patch(out.jump(), loopStart);
+      out.patch(exitJump, out.code.size());
+      out.load(0, X64Emitter::RSP, lastResult);
+      popTemp();
+      return;
+    }
+
+    case NodeKind::Set:
+      gen(*node.children[0]);
+      out.store(X64Emitter::RDI, param(node), 0);
+      return;
+
+    case NodeKind::CompoundAssign: {
+      const Node &operand = *node.children[1];
+      if (node.text == "/=" &&
+          (operand.kind != NodeKind::Number || operand.number == 0)) {
+        throw NotJittable(); // division by zero must raise an error
+      }
+      int32_t target = param(*node.children[0]);
+      if (!loadOperand(operand)) {
+        gen(operand);
+        out.copy0to1();
+      }
+      out.load(0, X64Emitter::RDI, target);
+      apply(node.text.substr(0, 1));
+      out.store(X64Emitter::RDI, target, 0);
+      return;
+    }
+
+    default:
+      throw NotJittable();
+    }
+  }
+};
+
+#endif
+
+struct JitEntry {
+  int calls = 0;
+  JitCode code = nullptr;
+};
+
+// Counts a call of def and returns its native code once it is hot and
+// compilable, nullptr otherwise.
+static JitCode jitCode(const Node *def) {
+  static unordered_map<const Node *, JitEntry> entries;
+  JitEntry &entry = entries[def];
+  if (entry.calls <= jitThreshold && ++entry.calls > jitThreshold) {
+#ifdef CPPLISP_X64_JIT
+    entry.code = JitCompiler(*def).compile();
+#endif
+  }
+  return entry.code;
+}
+
+// Tracing JIT for while loops. Once a loop has run traceThreshold
+// iterations, the next iteration is recorded: the condition and body are
+// walked with the variables' current values, every arithmetic step becomes
+// an instruction of a linear register IR and every if becomes a guard on the
+// direction it took. The trace is then run from the loop's current state
+// until the condition fails or a guard does.
+//
+// Variables are guarded to be numbers when the trace is entered; nothing in
+// a trace can change that. Writes inside an iteration go to temporaries and
+// are committed at its end, so a failing guard leaves the variables as they
+// were when the iteration began and the interpreter simply reruns it.
+
+static bool tracingEnabled = false;
+static constexpr int traceThreshold = 50;
+static constexpr int maxTraceRecordings = 4;
+static constexpr int maxSideExits = 64;
+
+enum class TraceOp : uint8_t {
+  Const,
+  Add,
+  Sub,
+  Mul,
+  Div,
+  Eq,
+  Ne,
+  Move,
+  ExitIfFalse, // leaves the loop
+  GuardTrue,   // side exit unless truthy
+  GuardFalse,  // side exit unless falsy
+  Loop
+};
+
+struct TraceIns {
+  TraceOp op;
+  uint16_t dst = 0, a = 0, b = 0;
+  double k = 0;
+};
+
+enum TraceExit { TraceDone = 0, TraceSideExit = 1 };
+
+using TraceCode = int (*)(double *registers);
+
+struct LoopTrace {
+  vector<Symbol> vars; // Register i holds vars[i]
+  uint16_t result = 0; // Latest body value, right after the variables
+  vector<TraceIns> code;
+  TraceCode native = nullptr;
+};
+
+static TraceOp traceOp(string_view op) {
+  static const unordered_map<string_view, TraceOp> ops = {
+      {"+", TraceOp::Add}, {"-", TraceOp::Sub},  {"*", TraceOp::Mul},
+      {"/", TraceOp::Div}, {"==", TraceOp::Eq}, {"!=", TraceOp::Ne}};
+  return ops.at(op);
+}
+
+static double applyTraceOp(TraceOp op, double x, double y) {
+  switch (op) {
+  case TraceOp::Add:
+    return x + y;
+  case TraceOp::Sub:
+    return x - y;
+  case TraceOp::Mul:
+    return x * y;
+  case TraceOp::Div:
+    return x / y;
+  case TraceOp::Eq:
+    return x == y ? 1.0 : 0.0;
+  default:
+    return x != y ? 1.0 : 0.0;
+  }
+}
+
+static int runTrace(const LoopTrace &trace, double *r) {
+  const TraceIns *code = trace.code.data();
+  const TraceIns *ins = code;
+  while (true) {
+    switch (ins->op) {
+    case TraceOp::Const:
+      r[ins->dst] = ins->k;
+      break;
+    case TraceOp::Move:
+      r[ins->dst] = r[ins->a];
+      break;
+    case TraceOp::ExitIfFalse:
+      if (r[ins->a] == 0) {
+        return TraceDone;
+      }
+      break;
+    case TraceOp::GuardTrue:
+      if (r[ins->a] == 0) {
+        return TraceSideExit;
+      }
+      break;
+    case TraceOp::GuardFalse:
+      if (r[ins->a] != 0) {
+        return TraceSideExit;
+      }
+      break;
+    case TraceOp::Loop:
+      ins = code;
+      continue;
+    default:
+      r[ins->dst] = applyTraceOp(ins->op, r[ins->a], r[ins->b]);
+    }
+    ins++;
+  }
+}
+
+class TraceRecorder {
+public:
+  explicit TraceRecorder(const Node &loop) : loop(loop) {}
+
+  // Whether the loop only does arithmetic on variables, so any trace of it
+  // can run without touching the interpreter.
+  bool traceable() {
+    for (const auto &child : loop.children) {
+      if (!collect(*child)) {
+        return false;
+      }
+    }
+    return loop.children.size() > 0;
+  }
+
+  // Records one iteration starting from the variables' current values.
+  // Returns nullptr when the loop is about to end or would raise an error.
+  unique_ptr<LoopTrace> record(Env &env, double lastResult) {
+    for (auto name : trace->vars) {
+      Value *binding = env.find(name);
+      if (!binding || !binding->isNumber()) {
+        return nullptr;
+      }
+      values.push_back(binding->number());
+      current.push_back(static_cast<uint16_t>(current.size()));
+    }
+    trace->result = static_cast<uint16_t>(values.size());
+    values.push_back(lastResult);
+
+    uint16_t condition = record(*loop.children[0]);
+    if (!aborted && values[condition] == 0) {
+      return nullptr;
+    }
+    emit({TraceOp::ExitIfFalse, 0, condition});
+
+    uint16_t last = trace->result;
+    for (size_t i = 1; i < loop.children.size() && !aborted; i++) {
+      last = record(*loop.children[i]);
+    }
+    if (aborted) {
+      return nullptr;
+    }
+
+    // Commit the iteration; no variable register is read after this point.
+    emit({TraceOp::Move, trace->result, last});
+    for (uint16_t i = 0; i < current.size(); i++) {
+      if (current[i] != i) {
+        emit({TraceOp::Move, i, current[i]});
+      }
+    }
+    emit({TraceOp::Loop});
+    return std::move(trace);
+  }
+
+  size_t registers() const { return values.size(); }
+
+private:
+  const Node &loop;
+  unique_ptr<LoopTrace> trace = make_unique<LoopTrace>();
+  vector<double> values;    // Value of every register in this iteration
+  vector<uint16_t> current; // Register holding each variable's latest value
+  bool aborted = false;
+
+  bool collect(const Node &node) {
+    switch (node.kind) {
+    case NodeKind::Number:
+      return true;
+    case NodeKind::Symbol:
+    case NodeKind::Set:
+      if (find(trace->vars.begin(), trace->vars.end(), node.symbol) ==
+          trace->vars.end()) {
+        trace->vars.push_back(node.symbol);
+      }
+      break;
+    case NodeKind::CompoundAssign:
+    case NodeKind::Operator:
+      break;
+    case NodeKind::If:
+      if (node.children.size() < 2 || node.children.size() > 3) {
+        return false;
+      }
+      break;
+    case NodeKind::Begin:
+      if (node.children.empty()) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+    }
+    for (const auto &child : node.children) {
+      if (!collect(*child)) {
+        return false;
+      }
+    }
+    return trace->vars.size() < 1024;
+  }
+
+  uint16_t var(Symbol name) {
+    return static_cast<uint16_t>(
+        find(trace->vars.begin(), trace->vars.end(), name) -
+        trace->vars.begin());
+  }
+
+  void emit(TraceIns ins) { trace->code.push_back(ins); }
+
+  uint16_t newRegister(double value) {
+    values.push_back(value);
+    return static_cast<uint16_t>(values.size() - 1);
+  }
+
+  uint16_t constant(double value) {
+    uint16_t dst = newRegister(value);
+    emit({TraceOp::Const, dst, 0, 0, value});
+    return dst;
+  }
+
+  uint16_t binary(TraceOp op, uint16_t a, uint16_t b) {
+    uint16_t dst = newRegister(applyTraceOp(op, values[a], values[b]));
+    emit({op, dst, a, b});
+    return dst;
+  }
+
+  // Variables may only be bound to temporaries until the commit.
+  void assign(Symbol name, uint16_t value) {
+    if (value < trace->vars.size()) {
+      uint16_t copy = newRegister(values[value]);
+      emit({TraceOp::Move, copy, value});
+      value = copy;
+    }
+    current[var(name)] = value;
+  }
+
+  uint16_t record(const Node &node) {
+    if (aborted || values.size() >= 60000) {
+      aborted = true;
+      return 0;
+    }
+
+    switch (node.kind) {
+    case NodeKind::Number:
+      return constant(node.number);
+
+    case NodeKind::Symbol:
+      return current[var(node.symbol)];
+
+    case NodeKind::Operator: {
+      if (node.children.empty()) {
+        return constant(0);
+      }
+      TraceOp op = traceOp(node.text);
+      uint16_t result = record(*node.children[0]);
+      for (size_t i = 1; i < node.children.size(); i++) {
+        result = binary(op, result, record(*node.children[i]));
+      }
+      return result;
+    }
+
+    case NodeKind::Begin: {
+      uint16_t result = 0;
+      for (const auto &child : node.children) {
+        result = record(*child);
+      }
+      return result;
+    }
+
+    case NodeKind::If: {
+      uint16_t condition = record(*node.children[0]);
+      if (values[condition] != 0) {
+        emit({TraceOp::GuardTrue, 0, condition});
+        return record(*node.children[1]);
+      }
+      emit({TraceOp::GuardFalse, 0, condition});
+      if (node.children.size() == 3) {
+        return record(*node.children[2]);
+      }
+      return constant(0);
+    }
+
+    case NodeKind::Set: {
+      uint16_t value = record(*node.children[0]);
+      assign(node.symbol, value);
+      return value;
+    }
+
+    case NodeKind::CompoundAssign: {
+      Symbol name = node.children[0]->symbol;
+      uint16_t operand = record(*node.children[1]);
+      if (node.symbol == divAssign) {
+        if (values[operand] == 0) {
+          aborted = true; // the interpreter raises the error
+          return 0;
+        }
+        emit({TraceOp::GuardTrue, 0, operand});
+      }
+      uint16_t result =
+          binary(traceOp(node.text.substr(0, 1)), current[var(name)], operand);
+      assign(name, result);
+      return result;
+    }
+
+    default:
+      aborted = true;
+      return 0;
+    }
+  }
+};
+
+#ifdef CPPLISP_X64_JIT
+
+// Registers live at [rdi + 8 * index]; the trace returns a TraceExit.
+static TraceCode compileTrace(const LoopTrace &trace) {
+  X64Emitter out;
+  vector<size_t> doneJumps, sideJumps;
+  auto reg = [](uint16_t index) { return static_cast<int32_t>(index) * 8; };
+  const uint8_t arithmetic[] = {0x58, 0x5C, 0x59, 0x5E};
+
+  size_t start = out.code.size();
+  for (const auto &ins : trace.code) {
+    switch (ins.op) {
+    case TraceOp::Const:
+      out.constant(0, ins.k);
+      out.store(X64Emitter::RDI, reg(ins.dst), 0);
+      break;
+    case TraceOp::Move:
+      out.load(0, X64Emitter::RDI, reg(ins.a));
+      out.store(X64Emitter::RDI, reg(ins.dst), 0);
+      break;
+    case TraceOp::ExitIfFalse:
+    case TraceOp::GuardTrue: {
+      auto &exits = ins.op == TraceOp::ExitIfFalse ? doneJumps : sideJumps;
+      out.load(0, X64Emitter::RDI, reg(ins.a));
+      out.testZero();
+      size_t truthy = out.jumpIf(X64Emitter::JP);
+      exits.push_back(out.jumpIf(X64Emitter::JE));
+      out.patch(truthy, out.code.size());
+      break;
+    }
+    case TraceOp::GuardFalse:
+      out.load(0, X64Emitter::RDI, reg(ins.a));
+      out.testZero();
+      sideJumps.push_back(out.jumpIf(X64Emitter::JP));
+      sideJumps.push_back(out.jumpIf(X64Emitter::JNE));
+      break;
+    case TraceOp::Loop:
+      out.patch(out.jump(), start);
+      break;
+    default:
+      out.load(0, X64Emitter::RDI, reg(ins.a));
+      out.load(1, X64Emitter::RDI, reg(ins.b));
+      if (ins.op == TraceOp::Eq || ins.op == TraceOp::Ne) {
+        out.compare(ins.op == TraceOp::Eq);
+      } else {
+        out.arithmetic(arithmetic[static_cast<int>(ins.op) -
+                                  static_cast<int>(TraceOp::Add)]);
+      }
+      out.store(X64Emitter::RDI, reg(ins.dst), 0);
+    }
+  }
+
+  for (size_t at : doneJumps) {
+    out.patch(at, out.code.size());
+  }
+  out.exit(TraceDone);
+  for (size_t at : sideJumps) {
+    out.patch(at, out.code.size());
+  }
+  out.exit(TraceSideExit);
+  return reinterpret_cast<TraceCode>(installCode(out.code));
+}
+
+#endif
+
+struct LoopState {
+  int iterations = 0;
+  int recordings = 0;
+  int sideExits = 0;
+  size_t registers = 0;
+  unique_ptr<LoopTrace> trace;
+};
+
+static LoopState &loopState(const Node *loop) {
+  static unordered_map<const Node *, LoopState> states;
+  return states[loop];
+}
+
+// Called before each interpreted iteration of loop. Runs the loop's trace
+// from the current state when there is one and returns true if that
+// finished the loop; false means the interpreter runs the next iteration.
+static bool runLoopTrace(Env &env, const Node &loop, LoopState &state,
+                         Value &lastResult) {
+  if (!state.trace) {
+    if (state.recordings >= maxTraceRecordings ||
+        ++state.iterations < traceThreshold) {
+      return false;
+    }
+    state.iterations = 0;
+    state.recordings++;
+    TraceRecorder recorder(loop);
+    if (!recorder.traceable()) {
+      state.recordings = maxTraceRecordings;
+      return false;
+    }
+    state.trace = recorder.record(
+        env, lastResult.isNumber() ? lastResult.number() : 0);
+    if (!state.trace) {
+      return false;
+    }
+    state.registers = recorder.registers();
+#ifdef CPPLISP_X64_JIT
+    state.trace->native = compileTrace(*state.trace);
+#endif
+  }
+
+  const LoopTrace &trace = *state.trace;
+  vector<double> registers(state.registers);
+  vector<Value *> bindings;
+  for (size_t i = 0; i < trace.vars.size(); i++) {
+    Value *binding = env.find(trace.vars[i]);
+    if (!binding || !binding->isNumber()) {
+      return false; // type guard failed: interpret this iteration
+    }
+    bindings.push_back(binding);
+    registers[i] = binding->number();
+  }
+  registers[trace.result] = lastResult.isNumber() ? lastResult.number() : 0;
+
+  int exit = trace.native ? trace.native(registers.data())
+                          : runTrace(trace, registers.data());
+
+  for (size_t i = 0; i < bindings.size(); i++) {
+    *bindings[i] = Value(registers[i]);
+  }
+  lastResult = Value(registers[trace.result]);
+  if (exit == TraceSideExit && ++state.sideExits >= maxSideExits) {
+    // The recorded path has gone cold; record the current one instead.
+    state.trace.reset();
+    state.sideExits = 0;
+  }
+  return exit == TraceDone;
+}
+
+static void expectArgs(size_t given, size_t count, const char *name) {
+  if (given != count) {
+    throw runtime_error(string(name) + " expects " + to_string(count) +
+                        " argument(s)");
+  }
+}
+
+// A numeric argument used as a position below end.
+static size_t indexArg(const Value &arg, size_t end, const char *name) {
+  if (!arg.isNumber()) {
+    throw runtime_error(string(name) + " expects a numeric index");
+  }
+  double index = arg.number();
+  if (index < 0 || index >= end) {
+    throw runtime_error(string(name) + " index out of range");
+  }
+  return static_cast<size_t>(index);
+}
+
+// Argument lists of builtins live in a region that belongs to the top-level
+// form being evaluated. Taking memory bumps a pointer, and as the lists are
+// given back in the reverse order, giving one back moves the pointer back.
+// Memory given back out of order stays taken until the form is done and
+// the region is reset. A list too large for what is left goes to the heap.
+class ScratchArena {
+public:
+  static void *allocate(size_t bytes) {
+    bytes = rounded(bytes);
+    if (bytes > size_t(region + regionBytes - top)) {
+      return ::operator new(bytes);
+    }
+    void *memory = top;
+    top += bytes;
+    return memory;
+  }
+
+  static void deallocate(void *memory, size_t bytes) {
+    char *start = static_cast<char *>(memory);
+    if (start < region || start >= region + regionBytes) {
+      ::operator delete(memory);
+    } else if (start + rounded(bytes) == top) {
+      top = start;
+    }
+  }
+
+  static void reset() { top = region; }
+
+private:
+  static constexpr size_t regionBytes = 1 << 20;
+  alignas(16) static inline char region[regionBytes];
+  static inline char *top = region;
+
+  static size_t rounded(size_t bytes) { return (bytes + 15) & ~size_t(15); }
+};
+
+template <class T> struct ScratchAllocator {
+  using value_type = T;
+
+  ScratchAllocator() = default;
+  template <class U> ScratchAllocator(const ScratchAllocator<U> &) {}
+
+  T *allocate(size_t count) {
+    return static_cast<T *>(ScratchArena::allocate(count * sizeof(T)));
+  }
+  void deallocate(T *memory, size_t count) {
+    ScratchArena::deallocate(memory, count * sizeof(T));
+  }
+  bool operator==(const ScratchAllocator &) const { return true; }
+  bool operator!=(const ScratchAllocator &) const { return false; }
+};
+
+// The evaluated arguments of a builtin. Engines reserve the exact count up
+// front so the list takes its memory once.
+using Args = vector<Value, ScratchAllocator<Value>>;
+
+// Builtins take their already evaluated arguments, so every engine shares
+// them. The arguments are owned by the callee and may be moved from.
+static Value applyBuiltin(Env &env, NodeKind kind, Args &args) {
+  switch (kind) {
+  case NodeKind::Display: {
+    expectArgs(args.size(), 1, "display");
+    if (auto *strObj = args[0].as<StringObj>()) {
+      cout << strObj->value << endl;
+    } else {
+      cout << args[0].toString() << endl;
+    }
+    return Value::voidValue();
+  }
+
+  case NodeKind::Eval: {
+    expectArgs(args.size(), 1, "eval");
+    auto &source = args[0].expect<StringObj>("eval expects a string argument");
+    Reader reader(source.value);
+    Value result = Value::voidValue();
+    while (const Node *form = reader.read()) {
+      result = evalForm(env, *form);
+    }
+    return result;
+  }
+
+  case NodeKind::List:
+  {
+    Value list(make_unique<ListObj>());
+    for (size_t i = args.size(); i-- > 0;) {
+      list = Value(make_unique<ListObj>(std::move(args[i]), std::move(list)));
+    }
+    return list;
+  }
+
+  case NodeKind::Get: {
+    expectArgs(args.size(), 2, "get");
+    if (auto *vec = args[0].as<VectorObj>()) {
+      return vec->at(indexArg(args[1], vec->size(), "get"));
+    }
+    const ListObj *list = args[0].as<ListObj>();
+    if (!list || !args[1].isNumber()) {
+      throw runtime_error("get expects a list or a vector and an index");
+    }
+    double index = args[1].number();
+    if (index < 0 || index >= list->length) {
+      throw runtime_error("get index out of range");
+    }
+    for (size_t i = static_cast<size_t>(index); i > 0; i--) {
+      list = list->next();
+    }
+    return list->first;
+  }
+
+  case NodeKind::Car: {
+    expectArgs(args.size(), 1, "car");
+    if (auto *list = args[0].as<ListObj>()) {
+      if (list->length > 0) {
+        return list->first;
+      }
+    }
+    throw runtime_error("car expects a non-empty list");
+  }
+
+  case NodeKind::Cdr: {
+    expectArgs(args.size(), 1, "cdr");
+    if (auto *list = args[0].as<ListObj>()) {
+      if (list->length > 1) {
+        return list->rest;
+      }
+    }
+    throw runtime_error("cdr expects a list with at least two elements");
+  }
+
+  case NodeKind::Cons: {
+    expectArgs(args.size(), 2, "cons");
+    args[1].expect<ListObj>("cons expects a list as the second argument");
+    return Value(make_unique<ListObj>(std::move(args[0]), std::move(args[1])));
+  }
+
+  case NodeKind::Len: {
+    expectArgs(args.size(), 1, "len");
+    if (auto *vec = args[0].as<VectorObj>()) {
+      return Value(static_cast<double>(vec->size()));
+    }
+    auto &list =
+        args[0].expect<ListObj>("len expects a list or a vector argument");
+    return Value(static_cast<double>(list.length));
+  }
+
+  case NodeKind::LenOfList:
+    return Value(static_cast<double>(args.size()));
+
+  case NodeKind::CarOfList:
+    if (args.empty()) {
+      throw runtime_error("car expects a non-empty list");
+    }
+    return std::move(args[0]);
+
+  case NodeKind::LenOfCons:
+  case NodeKind::CarOfCons:
+  case NodeKind::CdrOfCons: {
+    auto &rest =
+        args[1].expect<ListObj>("cons expects a list as the second argument");
+    if (kind == NodeKind::LenOfCons) {
+      return Value(static_cast<double>(rest.length + 1));
+    }
+    if (kind == NodeKind::CarOfCons) {
+      return std::move(args[0]);
+    }
+    if (rest.length == 0) {
+      throw runtime_error("cdr expects a list with at least two elements");
+    }
+    return std::move(args[1]);
+  }
+
+  case NodeKind::ToString:
+    expectArgs(args.size(), 1, "toString");
+    return Value(make_unique<StringObj>(args[0].toString()));
+
+  case NodeKind::Vector:
+    return Value(make_unique<VectorObj>(args.data(), args.size()));
+
+  case NodeKind::Push: {
+    expectArgs(args.size(), 2, "push");
+    auto &vec = args[0].expect<VectorObj>("push expects a vector");
+    return vec.push(std::move(args[1]));
+  }
+
+  case NodeKind::SetNth: {
+    expectArgs(args.size(), 3, "set-nth");
+    auto &vec = args[0].expect<VectorObj>("set-nth expects a vector");
+    size_t index = indexArg(args[1], vec.size(), "set-nth");
+    return vec.set(index, std::move(args[2]));
+  }
+
+  case NodeKind::Concat: {
+    expectArgs(args.size(), 2, "concat");
+    auto &left = args[0].expect<VectorObj>("concat expects two vectors");
+    auto &right = args[1].expect<VectorObj>("concat expects two vectors");
+    return left.concat(right);
+  }
+
+  case NodeKind::Slice: {
+    expectArgs(args.size(), 3, "slice");
+    auto &vec = args[0].expect<VectorObj>("slice expects a vector");
+    size_t start = indexArg(args[1], vec.size() + 1, "slice");
+    size_t end = indexArg(args[2], vec.size() + 1, "slice");
+    if (start > end) {
+      throw runtime_error("slice start is past its end");
+    }
+    return vec.slice(start, end);
+  }
+
+  default:
+    throw runtime_error("Invalid Input");
+  }
+}
+
+static bool isTruthy(const Value &condition) {
+  return condition.isNumber() && condition.number() != 0;
+}
+
+// Evaluates children[first..] but the last, which is returned for the
+// caller to evaluate in tail position; null if there are none.
+static const Node *evalLeading(Env &env, const Node &node, size_t first) {
+  if (node.children.size() <= first) {
+    return nullptr;
+  }
+  for (size_t i = first; i + 1 < node.children.size(); i++) {
+    evalExpr(env, *node.children[i]);
+  }
+  return node.children.back().get();
+}
+
+// Evaluates the arguments of a call to lambda into a new frame. A call the
+// method JIT finishes on numbers needs none, and sets result instead.
+static bool bindCall(Env &env, const LambdaObj &lambda, const Node &call,
+                     optional<Env> &frame, Value &result) {
+  const Node *def = lambda.def;
+  if (call.children.size() - 1 != def->names.size()) {
+    throw runtime_error("lambda expects " + to_string(def->names.size()) +
+                        " argument(s)");
+  }
+
+  size_t argc = def->names.size();
+  bool jit = jitEnabled && lambda.captured.empty();
+  if (JitCode code = jit ? jitCode(def) : nullptr) {
+    Value values[maxJitParams];
+    double params[maxJitParams];
+    bool numeric = true;
+    for (size_t i = 0; i < argc; i++) {
+      values[i] = evalExpr(env, *call.children[i + 1]);
+      numeric = numeric && values[i].isNumber();
+      params[i] = values[i].number();
+    }
+    if (numeric) {
+      result = Value(code(params));
+      return false;
+    }
+    Env &newEnv = frame.emplace(&env.global(), def->nameSymbols,
+                                def->starts);
+    for (size_t i = 0; i < argc; i++) {
+      newEnv.slot(i) = std::move(values[i]);
+    }
+    return true;
+  }
+
+  // Arguments are evaluated in the caller's scope straight into the new
+  // frame, which nothing can see until the body runs. It takes the
+  // captures first, as the arguments may drop the last use of the lambda.
+  Env &newEnv = frame.emplace(&env.global(), def->nameSymbols, def->starts);
+  bindCaptures(newEnv, lambda);
+  for (size_t i = 0; i < argc; i++) {
+    newEnv.slot(i) = evalExpr(env, *call.children[i + 1]);
+  }
+  return true;
+}
+
+// Evaluates the forms that have one in tail position. That one is taken
+// by the next turn of the loop rather than a nested call, so the C++ stack
+// only grows with nesting and a tail call costs no more than a jump: the
+// branches of an if, the last form of a begin or let body and the body of
+// a called lambda.
+static Value evalTail(Env &callerEnv, const Node &first) {
+  Env *scope = &callerEnv;
+  const Node *form = &first;
+  // The frame of the lambda called last, and the one a tail call builds
+  // while that is still in use.
+  optional<Env> frames[2];
+  size_t frame = 0;
+  // The first let entered since the last call, and any within it.
+  optional<Env> let;
+  vector<unique_ptr<Env>> lets;
+  for (;;) {
+    Env &env = *scope;
+    const Node &node = *form;
+    switch (node.kind) {
+    case NodeKind::Begin:
+      form = evalLeading(env, node, 0);
+      if (!form) {
+        return Value::voidValue();
+      }
+      continue;
+
+    case NodeKind::If: {
+      if (node.children.size() < 2 || node.children.size() > 3) {
+        throw runtime_error("if expects a condition and one or two branches");
+      }
+      if (isTruthy(evalExpr(env, *node.children[0]))) {
+        form = node.children[1].get();
+      } else if (node.children.size() == 3) {
+        form = node.children[2].get();
+      } else {
+        return Value(0.0);
+      }
+      continue;
+    }
+
+    case NodeKind::Let: {
+      Env *newEnv;
+      if (!let) {
+        newEnv = &let.emplace(&env, node.nameSymbols, node.starts);
+      } else {
+        lets.push_back(
+            make_unique<Env>(&env, node.nameSymbols, node.starts));
+        newEnv = lets.back().get();
+      }
+      for (size_t i = 0; i < node.names.size(); i++) {
+        newEnv->slot(i) = evalExpr(env, *node.children[i]);
+      }
+      scope = newEnv;
+      form = evalLeading(*scope, node, node.names.size());
+      if (!form) {
+        return Value::voidValue();
+      }
+      continue;
+    }
+
+    case NodeKind::Apply: {
+      const Node &callee = *node.children[0];
+      const LambdaObj *lambda = nullptr;
+      Value value;
+      if (callee.kind == NodeKind::Symbol) {
+        Value *binding = findBinding(env, callee);
+        if (!binding) {
+          throw runtime_error("Undefined variable: " + string(callee.text));
+        }
+        lambda = binding->as<LambdaObj>();
+      }
+      if (!lambda) {
+        value = evalExpr(env, callee);
+        lambda = value.as<LambdaObj>();
+      }
+      if (!lambda) {
+        if (node.children.size() == 1) {
+          return value;
+        }
+        throw runtime_error("Cannot apply " + value.toString());
+      }
+
+      const Node *def = lambda->def;
+      if (!bindCall(env, *lambda, node, frames[frame ^ 1], value)) {
+        return value;
+      }
+      // Nothing here is needed any more, so the call replaces it.
+      lets.clear();
+      let.reset();
+      frames[frame].reset();
+      frame ^= 1;
+      scope = &*frames[frame];
+      form = evalLeading(*scope, *def, 0);
+      if (!form) {
+        return Value::voidValue();
+      }
+      continue;
+    }
+
+    default:
+      return evalExpr(env, node);
+    }
+  }
+}
+
+Value evalExpr(Env &env, const Node &node) {
+  switch (node.kind) {
+  case NodeKind::Number:
+    return Value(node.number);
+
+  case NodeKind::String:
+    return Value(make_unique<StringObj>(node.text));
+
+  case NodeKind::Symbol: {
+    auto *binding = findBinding(env, node);
+    if (!binding) {
+      throw runtime_error("Undefined variable: " + string(node.text));
+    }
+    return *binding;
+  }
+
+  case NodeKind::Operator: {
+    if (node.children.empty()) {
+      return Value(0.0);
+    }
+
+    double result = 0;
+    for (size_t i = 0; i < node.children.size(); i++) {
+      Value next = evalExpr(env, *node.children[i]);
+      if (!next.isNumber()) {
+        throw runtime_error(string(node.text) + " expects numbers");
+      }
+      result = i == 0 ? next.number() : (*node.op)(result, next.number());
+    }
+    return Value(result);
+  }
+
+  case NodeKind::CompoundAssign: {
+    const Node &target = *node.children[0];
+    auto *binding = findBinding(env, target);
+    Env *scope = binding && target.slot < 0
+                     ? env.findDefiningScope(target.symbol)
+                     : nullptr;
+    if (!binding || !binding->isNumber()) {
+      throw runtime_error(string(node.text) +
+                          " requires a valid number variable");
+    }
+
+    Value operand = evalExpr(env, *node.children[1]);
+    if (!operand.isNumber()) {
+      throw runtime_error(string(node.text) +
+                          " requires a valid numeric argument");
+    }
+    if (node.symbol == divAssign && operand.number() == 0) {
+      throw runtime_error("/= cannot divide by zero");
+    }
+
+    // evaluating the operand may have rebound the variable
+    if (scope) {
+      binding = scope->find(target.symbol);
+    }
+    if (!binding->isNumber()) {
+      throw runtime_error(string(node.text) +
+                          " requires a valid number variable");
+    }
+    *binding = Value((*node.op)(binding->number(), operand.number()));
+    return Value(binding->number());
+  }
+
+  case NodeKind::Define: {
+    Value value = evalExpr(env, *node.children[0]);
+    env.set(node.symbol, value);
+    return value;
+  }
+
+  case NodeKind::While: {
+    if (node.children.empty()) {
+      throw runtime_error("while expects a condition");
+    }
+    Value lastResult(0.0);
+    LoopState *trace = tracingEnabled ? &loopState(&node) : nullptr;
+    while (!(trace && runLoopTrace(env, node, *trace, lastResult)) &&
+           isTruthy(evalExpr(env, *node.children[0]))) {
+      for (size_t i = 1; i < node.children.size(); i++) {
+        lastResult = evalExpr(env, *node.children[i]);
+      }
+    }
+    return lastResult;
+  }
+
+  case NodeKind::Lambda:
+    return makeLambda(env, node);
+
+  case NodeKind::Set: {
+    Value newValue = evalExpr(env, *node.children[0]);
+    if (node.slot >= 0) {
+      env.at(node.depth, node.slot) = newValue;
+      return newValue;
+    } else if (env.setExisting(node.symbol, newValue)) {
+      return newValue;
+    } else {
+      throw runtime_error("Variable not found for set!");
+    }
+  }
+
+  case NodeKind::Display:
+  case NodeKind::Eval:
+  case NodeKind::List:
+  case NodeKind::Get:
+  case NodeKind::Car:
+  case NodeKind::Cdr:
+  case NodeKind::Cons:
+  case NodeKind::Len:
+  case NodeKind::ToString:
+  case NodeKind::Vector:
+  case NodeKind::Push:
+  case NodeKind::SetNth:
+  case NodeKind::Concat:
+  case NodeKind::Slice:
+  case NodeKind::LenOfList:
+  case NodeKind::CarOfList:
+  case NodeKind::LenOfCons:
+  case NodeKind::CarOfCons:
+  case NodeKind::CdrOfCons: {
+    Args args;
+    args.reserve(node.children.size());
+    for (const auto &child : node.children) {
+      args.push_back(evalExpr(env, *child));
+    }
+    return applyBuiltin(env, node.kind, args);
+  }
+
+  case NodeKind::Begin:
+  case NodeKind::If:
+  case NodeKind::Let:
+  case NodeKind::Apply:
+    return evalTail(env, node);
+  }
+
+  throw runtime_error("Invalid Input");
+}
+
+// Bytecode engine: each form is compiled once into a compact instruction
+// stream and run by a stack machine that keeps numbers unboxed. Lambda
+// bodies are compiled on their first call and cached by their parse node.
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CPPLISP_COMPUTED_GOTO 1
+#endif
+
+// name, lisp operator, result for operands x and y
+#define VM_BINARY_OPS(X)                                                       \
+  X(Add, "+", x + y)                                                           \
+  X(Sub, "-", x - y)                                                           \
+  X(Mul, "*", x * y)                                                           \
+  X(Div, "/", x / y)                                                           \
+  X(Eq, "==", x == y ? 1.0 : 0.0)                                              \
+  X(Ne, "!=", x != y ? 1.0 : 0.0)
+
+// Every binary operator has a plain form working on the two topmost stack
+// slots and three superinstructions: top op constant, variable op constant
+// and variable op variable.
+#define VM_OPCODES(X)                                                          \
+  X(Const) X(String) X(Void) X(MakeLambda) X(Load) X(LoadLocal) X(Define)      \
+  X(Set) X(SetLocal) X(Compound) X(Incr) X(Pop) X(Jump) X(JumpIfFalse)         \
+  X(CheckNumber)                                                               \
+  X(Builtin) X(CallName) X(Call) X(TailCallName) X(TailCall) X(EnterScope)     \
+  X(LeaveScope) X(Return)                                                      \
+  X(Add) X(Sub) X(Mul) X(Div) X(Eq) X(Ne)                                     \
+  X(AddC) X(SubC) X(MulC) X(DivC) X(EqC) X(NeC)                               \
+  X(AddVC) X(SubVC) X(MulVC) X(DivVC) X(EqVC) X(NeVC)                         \
+  X(AddVV) X(SubVV) X(MulVV) X(DivVV) X(EqVV) X(NeVV)
+
+enum class Op : int32_t {
+#define VM_ENUM(name) name,
+  VM_OPCODES(VM_ENUM)
+#undef VM_ENUM
+};
+
+static constexpr int32_t binaryOpCount = 6;
+static const char *const binaryOpNames[binaryOpCount] = {"+",  "-",  "*",
+                                                         "/",  "==", "!="};
+
+static int32_t binaryOpIndex(string_view name) {
+  for (int32_t i = 0; i < binaryOpCount; i++) {
+    if (name == binaryOpNames[i]) {
+      return i;
+    }
+  }
+  throw runtime_error("Unknown operator " + string(name));
+}
+
+struct Chunk {
+  vector<int32_t> code;
+  vector<double> numbers;
+  vector<string_view> names;
+  vector<Symbol> symbols; // The names, interned
+  vector<const Node *> nodes; // String literals, lambdas and let forms
+  size_t maxStack = 0;
+};
+
+class Compiler {
+public:
+  explicit Compiler(Chunk &chunk) : chunk(chunk) {}
+
+  void compileForm(const Node &node) {
+    compile(node);
+    emit(Op::Return, -1);
+  }
+
+  void compileBody(const Node &node, size_t first) {
+    compileSequence(node, first, true);
+    emit(Op::Return, -1);
+  }
+
+private:
+  Chunk &chunk;
+  size_t depth = 0;
+
+  void emit(Op op, int stackEffect) {
+    chunk.code.push_back(static_cast<int32_t>(op));
+    depth += stackEffect;
+    chunk.maxStack = max(chunk.maxStack, depth);
+  }
+
+  void operand(size_t value) {
+    chunk.code.push_back(static_cast<int32_t>(value));
+  }
+
+  size_t number(double value) {
+    chunk.numbers.push_back(value);
+    return chunk.numbers.size() - 1;
+  }
+
+  size_t name(string_view value) {
+    auto it = find(chunk.names.begin(), chunk.names.end(), value);
+    if (it != chunk.names.end()) {
+      return it - chunk.names.begin();
+    }
+    chunk.names.push_back(value);
+    chunk.symbols.push_back(symbolTable.intern(value));
+    return chunk.names.size() - 1;
+  }
+
+  // A variable as two operands: its lexical address, or -1 and its name
+  // when it is looked up at run time.
+  void variable(const Node &ref) {
+    if (ref.slot >= 0) {
+      operand(ref.depth);
+      operand(ref.slot);
+      return;
+    }
+    chunk.code.push_back(-1);
+    operand(name(ref.text));
+  }
+
+  size_t nodeIndex(const Node &node) {
+    chunk.nodes.push_back(&node);
+    return chunk.nodes.size() - 1;
+  }
+
+  size_t jump(Op op, int stackEffect) {
+    emit(op, stackEffect);
+    operand(0);
+    return chunk.code.size() - 1;
+  }
+
+  void patch(size_t at) { chunk.code[at] = chunk.code.size(); }
+
+  void emitOp(Op base, int32_t op, int stackEffect) {
+    emit(static_cast<Op>(static_cast<int32_t>(base) + op), stackEffect);
+  }
+
+  // Leaves the value of children[first..] on the stack, Void when empty.
+  void compileSequence(const Node &node, size_t first, bool tail = false) {
+    if (first == node.children.size()) {
+      emit(Op::Void, 1);
+      return;
+    }
+    for (size_t i = first; i < node.children.size(); i++) {
+      if (i > first) {
+        emit(Op::Pop, -1);
+      }
+      compile(*node.children[i], tail && i + 1 == node.children.size());
+    }
+  }
+
+  void compileOperator(const Node &node) {
+    int32_t op = binaryOpIndex(node.text);
+    const auto &args = node.children;
+    if (args.empty()) {
+      emit(Op::Const, 1);
+      operand(number(0));
+      return;
+    }
+
+    size_t next = 1;
+    if (args.size() >= 2 && args[0]->kind == NodeKind::Symbol &&
+        args[1]->kind == NodeKind::Number) {
+      emitOp(Op::AddVC, op, 1);
+      variable(*args[0]);
+      operand(number(args[1]->number));
+      next = 2;
+    } else if (args.size() >= 2 && args[0]->kind == NodeKind::Symbol &&
+               args[1]->kind == NodeKind::Symbol) {
+      emitOp(Op::AddVV, op, 1);
+      variable(*args[0]);
+      variable(*args[1]);
+      next = 2;
+    } else {
+      compile(*args[0]);
+      if (args.size() == 1) {
+        emit(Op::CheckNumber, 0);
+        operand(op);
+      }
+    }
+
+    for (size_t i = next; i < args.size(); i++) {
+      if (args[i]->kind == NodeKind::Number) {
+        emitOp(Op::AddC, op, 0);
+        operand(number(args[i]->number));
+      } else {
+        compile(*args[i]);
+        emitOp(Op::Add, op, -1);
+      }
+    }
+  }
+
+  // A call in tail position, whose value the lambda body returns as it
+  // is, leaves the call to VM::call so the stack stays flat.
+  void compile(const Node &node, bool tail = false) {
+    switch (node.kind) {
+    case NodeKind::Number:
+      emit(Op::Const, 1);
+      operand(number(node.number));
+      return;
+
+    case NodeKind::String:
+      emit(Op::String, 1);
+      operand(nodeIndex(node));
+      return;
+
+    case NodeKind::Symbol:
+      if (node.slot >= 0) {
+        emit(Op::LoadLocal, 1);
+        operand(node.depth);
+        operand(node.slot);
+        return;
+      }
+      emit(Op::Load, 1);
+      operand(name(node.text));
+      return;
+
+    case NodeKind::Operator:
+      compileOperator(node);
+      return;
+
+    case NodeKind::CompoundAssign: {
+      const Node &value = *node.children[1];
+      int32_t op = binaryOpIndex(node.text.substr(0, 1));
+      if (value.kind == NodeKind::Number &&
+          (node.text == "+=" || node.text == "-=")) {
+        emit(Op::Incr, 1);
+        operand(op);
+        variable(*node.children[0]);
+        operand(number(node.text == "+=" ? value.number : -value.number));
+        return;
+      }
+      compile(value);
+      emit(Op::Compound, 0);
+      operand(op);
+      variable(*node.children[0]);
+      return;
+    }
+
+    case NodeKind::Define:
+      compile(*node.children[0]);
+      emit(Op::Define, 0);
+      operand(name(node.text));
+      return;
+
+    case NodeKind::Set:
+      compile(*node.children[0]);
+      if (node.slot >= 0) {
+        emit(Op::SetLocal, 0);
+        operand(node.depth);
+        operand(node.slot);
+        return;
+      }
+      emit(Op::Set, 0);
+      operand(name(node.text));
+      return;
+
+    case NodeKind::Begin:
+      compileSequence(node, 0, tail);
+      return;
+
+    case NodeKind::If: {
+      if (node.children.size() < 2 || node.children.size() > 3) {
+        throw runtime_error("if expects a condition and one or two branches");
+      }
+      compile(*node.children[0]);
+      size_t elseJump = jump(Op::JumpIfFalse, -1);
+      compile(*node.children[1], tail);
+      size_t endJump = jump(Op::Jump, -1);
+      patch(elseJump);
+      if (node.children.size() == 3) {
+        compile(*node.children[2], tail);
+      } else {
+        emit(Op::Const, 1);
+        operand(number(0));
+      }
+      patch(endJump);
+      return;
+    }
+
+    case NodeKind::While: {
+      if (node.children.empty()) {
+        throw runtime_error("while expects a condition");
+      }
+      // The slot below the condition holds the latest body result.
+      emit(Op::Const, 1);
+      operand(number(0));
+      size_t loopStart = chunk.code.size();
+      compile(*node.children[0]);
+      size_t exitJump = jump(Op::JumpIfFalse, -1);
+      for (size_t i = 1; i < node.children.size(); i++) {
+        emit(Op::Pop, -1);
+        compile(*node.children[i]);
+      }
+      emit(Op::Jump, 0);
+      operand(loopStart);
+      patch(exitJump);
+      return;
+    }
+
+    case NodeKind::Lambda:
+      emit(Op::MakeLambda, 1);
+      operand(nodeIndex(node));
+      return;
+
+    case NodeKind::Let: {
+      size_t count = node.names.size();
+      for (size_t i = 0; i < count; i++) {
+        compile(*node.children[i]);
+      }
+      emit(Op::EnterScope, -static_cast<int>(count));
+      operand(nodeIndex(node));
+      compileSequence(node, count, tail);
+      emit(Op::LeaveScope, 0);
+      return;
+    }
+
+    case NodeKind::Display:
+    case NodeKind::Eval:
+    case NodeKind::List:
+    case NodeKind::Get:
+    case NodeKind::Car:
+    case NodeKind::Cdr:
+    case NodeKind::Cons:
+    case NodeKind::Len:
+    case NodeKind::ToString:
+    case NodeKind::Vector:
+    case NodeKind::Push:
+    case NodeKind::SetNth:
+    case NodeKind::Concat:
+    case NodeKind::Slice:
+    case NodeKind::LenOfList:
+    case NodeKind::CarOfList:
+    case NodeKind::LenOfCons:
+    case NodeKind::CarOfCons:
+    case NodeKind::CdrOfCons: {
+      for (const auto &child : node.children) {
+        compile(*child);
+      }
+      int argc = node.children.size();
+      emit(Op::Builtin, 1 - argc);
+      operand(static_cast<size_t>(node.kind));
+      operand(argc);
+      return;
+    }
+
+    case NodeKind::Apply: {
+      const Node &callee = *node.children[0];
+      int argc = node.children.size() - 1;
+      if (callee.kind != NodeKind::Symbol) {
+        compile(callee);
+      }
+      for (size_t i = 1; i < node.children.size(); i++) {
+        compile(*node.children[i]);
+      }
+      if (callee.kind == NodeKind::Symbol) {
+        emit(tail ? Op::TailCallName : Op::CallName, 1 - argc);
+        operand(name(callee.text));
+      } else {
+        emit(tail ? Op::TailCall : Op::Call, -argc);
+      }
+      operand(argc);
+      return;
+    }
+    }
+  }
+};
+
+// Resolved bindings of one VM frame. Bindings live in hash map nodes that
+// never move, so a cached pointer stays valid until a new binding may shadow
+// it: a define or eval in the current scope, or entering or leaving a let.
+class BindingCache {
+public:
+  explicit BindingCache(const Chunk &chunk)
+      : names(chunk.names), symbols(chunk.symbols) {
+    if (names.size() > inlineSize) {
+      heapSlots.resize(names.size());
+      slots = heapSlots.data();
+    }
+    clear();
+  }
+
+  Value *find(Env &env, int32_t index) {
+    Value *&slot = slots[index];
+    if (!slot) {
+      slot = env.find(symbols[index]);
+    }
+    return slot;
+  }
+
+  Value &get(Env &env, int32_t index) {
+    Value *binding = find(env, index);
+    if (!binding) {
+      throw runtime_error("Undefined variable: " + string(names[index]));
+    }
+    return *binding;
+  }
+
+  // The variable named by the two operands at code; see
+  // Compiler::variable.
+  Value *findVariable(Env &env, const int32_t *code) {
+    return code[0] >= 0 ? &env.at(code[0], code[1]) : find(env, code[1]);
+  }
+
+  Value &getVariable(Env &env, const int32_t *code) {
+    return code[0] >= 0 ? env.at(code[0], code[1]) : get(env, code[1]);
+  }
+
+  double getNumber(Env &env, const int32_t *code, const char *op) {
+    const Value &value = getVariable(env, code);
+    if (!value.isNumber()) {
+      throw runtime_error(string(op) + " expects numbers");
+    }
+    return value.number();
+  }
+
+  void clear() { fill(slots, slots + names.size(), nullptr); }
+
+private:
+  static constexpr size_t inlineSize = 16;
+  const vector<string_view> &names;
+  const vector<Symbol> &symbols;
+  Value *inlineSlots[inlineSize];
+  vector<Value *> heapSlots;
+  Value **slots = inlineSlots;
+};
+
+static const Chunk &lambdaChunk(const Node *def) {
+  static unordered_map<const Node *, unique_ptr<Chunk>> chunks;
+  auto &chunk = chunks[def];
+  if (!chunk) {
+    auto compiled = make_unique<Chunk>();
+    Compiler(*compiled).compileBody(*def, 0);
+    chunk = std::move(compiled);
+  }
+  return *chunk;
+}
+
+class VM {
+public:
+  Value run(const Chunk &chunk, Env &env) {
+    if (active) {
+      // eval re-entered the VM from a builtin
+      return execute(chunk, env, nestedBase);
+    }
+    active = true;
+    try {
+      Value result = execute(chunk, env, 0);
+      active = false;
+      return result;
+    } catch (...) {
+      // Unwinding leaves objects in the abandoned slots; pushes rely on
+      // every free slot holding no object.
+      for (auto &slot : stack) {
+        slot = Value();
+      }
+      active = false;
+      throw;
+    }
+  }
+
+private:
+  vector<Value> stack;
+  bool active = false;
+  size_t nestedBase = 0; // First free slot while a builtin runs
+  // The lambda of a tail call that execute left for call to make, with
+  // its arguments at the base of the finished frame.
+  Value tailCallee;
+  int tailArgc = 0;
+
+  Value execute(const Chunk &chunk, Env &frameEnv, size_t base);
+  Value call(const LambdaObj &lambda, Value *args, int argc, Env &env,
+             size_t base);
+  Value tailCall(Value callee, Value *args, int argc, size_t base);
+};
+
+static VM vm;
+
+// Calls lambda, and then every tail call its body leaves, in one loop.
+Value VM::call(const LambdaObj &lambda, Value *args, int argc, Env &env,
+               size_t base) {
+  const LambdaObj *callee = &lambda;
+  Value held; // The lambda of the latest tail call
+  while (true) {
+    const Node *def = callee->def;
+    if (static_cast<size_t>(argc) != def->names.size()) {
+      throw runtime_error("lambda expects " + to_string(def->names.size()) +
+                          " argument(s)");
+    }
+    bool jit = jitEnabled && callee->captured.empty();
+    if (JitCode code = jit ? jitCode(def) : nullptr) {
+      double params[maxJitParams];
+      int numbers = 0;
+      for (; numbers < argc && args[numbers].isNumber(); numbers++) {
+        params[numbers] = args[numbers].number();
+      }
+      if (numbers == argc) {
+        return Value(code(params));
+      }
+    }
+    Value result;
+    {
+      Env newEnv = callFrame(env, *callee);
+      for (int i = 0; i < argc; i++) {
+        newEnv.slot(i) = std::move(args[i]);
+      }
+      result = execute(lambdaChunk(def), newEnv, base);
+    }
+    if (!tailCallee.as<LambdaObj>()) {
+      return result;
+    }
+    held = std::move(tailCallee);
+    callee = held.as<LambdaObj>();
+    args = stack.data() + base;
+    argc = tailArgc;
+  }
+}
+
+// Ends the running frame with a call for VM::call to make in its place.
+Value VM::tailCall(Value callee, Value *args, int argc, size_t base) {
+  tailCallee = std::move(callee);
+  tailArgc = argc;
+  for (int i = 0; i < argc; i++) {
+    Value arg = std::move(args[i]);
+    stack[base + i] = std::move(arg);
+  }
+  return Value();
+}
+
+Value VM::execute(const Chunk &chunk, Env &frameEnv, size_t base) {
+  if (stack.size() < base + chunk.maxStack) {
+    stack.resize(max(base + chunk.maxStack, stack.size() * 2));
+  }
+  Value *top = stack.data() + base;
+  const int32_t *code = chunk.code.data();
+  const int32_t *ip = code;
+  Env *env = &frameEnv;
+  vector<unique_ptr<Env>> scopes;
+  BindingCache bindings(chunk);
+
+  // Instructions that may re-enter the VM grow the stack; refresh top.
+#define VM_SAVE() size_t saved = top - stack.data()
+#define VM_RESTORE() top = stack.data() + saved
+
+#ifdef CPPLISP_COMPUTED_GOTO
+  static void *const labels[] = {
+#define VM_LABEL(name) &&op_##name,
+      VM_OPCODES(VM_LABEL)
+#undef VM_LABEL
+  };
+#define VM_CASE(name) op_##name:
+#define VM_DISPATCH() goto *labels[*ip++]
+  VM_DISPATCH();
+#else
+#define VM_CASE(name) case Op::name:
+#define VM_DISPATCH() continue
+  while (true) {
+    switch (static_cast<Op>(*ip++)) {
+#endif
+
+  VM_CASE(Const) {
+    *top = Value(chunk.numbers[*ip++]);
+    ++top;
+    VM_DISPATCH();
+  }
+
+  VM_CASE(String) {
+    *top = Value(make_unique<StringObj>(chunk.nodes[*ip++]->text));
+    ++top;
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Void) {
+    *top = Value::voidValue();
+    ++top;
+    VM_DISPATCH();
+  }
+
+  VM_CASE(MakeLambda) {
+    const Node *def = chunk.nodes[*ip++];
+    *top++ = makeLambda(*env, *def);
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Load) {
+    *top++ = bindings.get(*env, *ip++);
+    VM_DISPATCH();
+  }
+
+  VM_CASE(LoadLocal) {
+    *top++ = env->at(ip[0], ip[1]);
+    ip += 2;
+    VM_DISPATCH();
+  }
+
+  VM_CASE(SetLocal) {
+    env->at(ip[0], ip[1]) = top[-1];
+    ip += 2;
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Define) {
+    env->set(chunk.symbols[*ip++], top[-1]);
+    bindings.clear();
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Set) {
+    Value *binding = bindings.find(*env, *ip++);
+    if (!binding) {
+      throw runtime_error("Variable not found for set!");
+    }
+    *binding = top[-1];
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Compound) {
+    int32_t op = *ip++;
+    Value *binding = bindings.findVariable(*env, ip);
+    ip += 2;
+    if (!binding || !binding->isNumber()) {
+      throw runtime_error(string(binaryOpNames[op]) +
+                          "= requires a valid number variable");
+    }
+    if (!top[-1].isNumber()) {
+      throw runtime_error(string(binaryOpNames[op]) +
+                          "= requires a valid numeric argument");
+    }
+    double x = binding->number(), y = top[-1].number(), result;
+    switch (op) {
+    case 0:
+      result = x + y;
+      break;
+    case 1:
+      result = x - y;
+      break;
+    case 2:
+      result = x * y;
+      break;
+    default:
+      if (y == 0) {
+        throw runtime_error("/= cannot divide by zero");
+      }
+      result = x / y;
+    }
+    *binding = Value(result);
+    top[-1] = Value(result);
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Incr) {
+    int32_t op = *ip++;
+    Value *binding = bindings.findVariable(*env, ip);
+    ip += 2;
+    if (!binding || !binding->isNumber()) {
+      throw runtime_error(string(binaryOpNames[op]) +
+                          "= requires a valid number variable");
+    }
+    *binding = Value(binding->number() + chunk.numbers[*ip++]);
+    *top++ = Value(binding->number());
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Pop) {
+    *--top = Value();
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Jump) {
+    ip = code + *ip;
+    VM_DISPATCH();
+  }
+
+  VM_CASE(JumpIfFalse) {
+    --top;
+    bool isTrue = isTruthy(*top);
+    *top = Value();
+    ip = isTrue ? ip + 1 : code + *ip;
+    VM_DISPATCH();
+  }
+
+  VM_CASE(CheckNumber) {
+    int32_t op = *ip++;
+    if (!top[-1].isNumber()) {
+      throw runtime_error(string(binaryOpNames[op]) + " expects numbers");
+    }
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Builtin) {
+    auto kind = static_cast<NodeKind>(*ip++);
+    int argc = *ip++;
+    // A computed goto leaves without running destructors, so the arguments
+    // go before the dispatch.
+    {
+      Args args;
+      args.reserve(argc);
+      for (int i = argc; i > 0; i--) {
+        args.push_back(std::move(top[-i]));
+      }
+      top -= argc;
+      VM_SAVE();
+      nestedBase = saved;
+      Value result = applyBuiltin(*env, kind, args);
+      VM_RESTORE();
+      *top++ = std::move(result);
+    }
+    if (kind == NodeKind::Eval) {
+      bindings.clear();
+    }
+    VM_DISPATCH();
+  }
+
+  VM_CASE(CallName) {
+    int32_t nameIndex = *ip++;
+    int argc = *ip++;
+    const Value &callee = bindings.get(*env, nameIndex);
+    if (auto *lambda = callee.as<LambdaObj>()) {
+      top -= argc;
+      VM_SAVE();
+      Value result = call(*lambda, top, argc, *env, saved);
+      VM_RESTORE();
+      *top++ = std::move(result);
+    } else if (argc == 0) {
+      *top++ = callee;
+    } else {
+      throw runtime_error("Cannot apply " + callee.toString());
+    }
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Call) {
+    int argc = *ip++;
+    Value &callee = top[-argc - 1];
+    if (auto *lambda = callee.as<LambdaObj>()) {
+      top -= argc;
+      VM_SAVE();
+      Value result = call(*lambda, top, argc, *env, saved);
+      VM_RESTORE();
+      top[-1] = std::move(result);
+    } else if (argc == 0) {
+      // A parenthesized value evaluates to itself
+    } else {
+      throw runtime_error("Cannot apply " + callee.toString());
+    }
+    VM_DISPATCH();
+  }
+
+  VM_CASE(TailCallName) {
+    int32_t nameIndex = *ip++;
+    int argc = *ip++;
+    const Value &callee = bindings.get(*env, nameIndex);
+    if (callee.as<LambdaObj>()) {
+      return tailCall(callee, top - argc, argc, base);
+    } else if (argc == 0) {
+      *top++ = callee;
+    } else {
+      throw runtime_error("Cannot apply " + callee.toString());
+    }
+    VM_DISPATCH();
+  }
+
+  VM_CASE(TailCall) {
+    int argc = *ip++;
+    Value &callee = top[-argc - 1];
+    if (callee.as<LambdaObj>()) {
+      return tailCall(std::move(callee), top - argc, argc, base);
+    } else if (argc != 0) {
+      throw runtime_error("Cannot apply " + callee.toString());
+    }
+    VM_DISPATCH();
+  }
+
+  VM_CASE(EnterScope) {
+    const Node *let = chunk.nodes[*ip++];
+    size_t count = let->names.size();
+    auto scope = make_unique<Env>(env, let->nameSymbols, let->starts);
+    for (size_t i = 0; i < count; i++) {
+      scope->slot(i) = std::move(top[i - count]);
+    }
+    top -= count;
+    env = scope.get();
+    scopes.push_back(std::move(scope));
+    bindings.clear();
+    VM_DISPATCH();
+  }
+
+  VM_CASE(LeaveScope) {
+    scopes.pop_back();
+    env = scopes.empty() ? &frameEnv : scopes.back().get();
+    bindings.clear();
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Return) {
+    return std::move(*--top);
+  }
+
+#define VM_BINARY_HANDLERS(name, symbol, result)                               \
+  VM_CASE(name) {                                                              \
+    Value &a = top[-2];                                                        \
+    Value &b = top[-1];                                                        \
+    if (!a.isNumber() || !b.isNumber()) {                                      \
+      throw runtime_error(symbol " expects numbers");                          \
+    }                                                                          \
+    double x = a.number(), y = b.number();                                     \
+    a = Value(result);                                                         \
+    --top;                                                                     \
+    VM_DISPATCH();                                                             \
+  }                                                                            \
+  VM_CASE(name##C) {                                                           \
+    Value &a = top[-1];                                                        \
+    if (!a.isNumber()) {                                                       \
+      throw runtime_error(symbol " expects numbers");                          \
+    }                                                                          \
+    double x = a.number(), y = chunk.numbers[*ip++];                           \
+    a = Value(result);                                                         \
+    VM_DISPATCH();                                                             \
+  }                                                                            \
+  VM_CASE(name##VC) {                                                          \
+    double x = bindings.getNumber(*env, ip, symbol);                           \
+    double y = chunk.numbers[ip[2]];                                           \
+    ip += 3;                                                                   \
+    *top++ = Value(result);                                                    \
+    VM_DISPATCH();                                                             \
+  }                                                                            \
+  VM_CASE(name##VV) {                                                          \
+    double x = bindings.getNumber(*env, ip, symbol);                           \
+    double y = bindings.getNumber(*env, ip + 2, symbol);                       \
+    ip += 4;                                                                   \
+    *top++ = Value(result);                                                    \
+    VM_DISPATCH();                                                             \
+  }
+
+  VM_BINARY_OPS(VM_BINARY_HANDLERS)
+#undef VM_BINARY_HANDLERS
+
+#ifndef CPPLISP_COMPUTED_GOTO
+    }
+  }
+#endif
+#undef VM_CASE
+#undef VM_DISPATCH
+#undef VM_SAVE
+#undef VM_RESTORE
+}
+
+// A tail call that a lambda body left to be made once its frame is gone,
+// by the closure and specializing engines.
+struct PendingCall {
+  Value callee; // No object when none waits
+  vector<Value> args;
+};
+
+static void checkArgCount(const Node *def, size_t argc) {
+  if (argc != def->names.size()) {
+    throw runtime_error("lambda expects " + to_string(def->names.size()) +
+                        " argument(s)");
+  }
+}
+
+// Makes the call in pending, and each tail call its body leaves in turn.
+// run(def, frame) runs the body of def in its frame.
+template <class Run>
+__attribute__((noinline)) static Value makeTailCalls(PendingCall &pending,
+                                                     Env &env, Run run) {
+  Value result;
+  while (pending.callee.obj()) {
+    Value callee = std::move(pending.callee);
+    vector<Value> args = std::move(pending.args);
+    const auto &lambda = *callee.as<LambdaObj>();
+    const Node *def = lambda.def;
+    checkArgCount(def, args.size());
+    bool jit = jitEnabled && lambda.captured.empty();
+    if (JitCode code = jit ? jitCode(def) : nullptr) {
+      double params[maxJitParams];
+      size_t numbers = 0;
+      for (; numbers < args.size() && args[numbers].isNumber(); numbers++) {
+        params[numbers] = args[numbers].number();
+      }
+      if (numbers == args.size()) {
+        return Value(code(params));
+      }
+    }
+    Env newEnv = callFrame(env, lambda);
+    for (size_t i = 0; i < args.size(); i++) {
+      newEnv.slot(i) = std::move(args[i]);
+    }
+    result = run(def, newEnv);
+  }
+  return result;
+}
+
+// Closure engine: every form is translated once into a tree of pre-bound C++
+// callables, one per special form and builtin, each holding its translated
+// operands. Running a form is a chain of indirect calls with no dispatch on
+// node kinds. Values are passed unboxed like on the VM stack.
+using Closure = function<Value(Env &)>;
+
+static double numberOf(const Value &value, const char *op) {
+  if (!value.isNumber()) {
+    throw runtime_error(string(op) + " expects numbers");
+  }
+  return value.number();
+}
+
+#define CLOSURE_OP_FN(name, symbol, result)                                    \
+  struct name##Fn {                                                            \
+    static double apply(double x, double y) { return result; }                 \
+  };
+VM_BINARY_OPS(CLOSURE_OP_FN)
+#undef CLOSURE_OP_FN
+
+// A form in tail position, whose value the lambda body returns as it is,
+// is compiled with tail set. A call there leaves itself in closureTail
+// for callClosure to make once the frame it was made from is gone.
+static Closure compileClosure(const Node &node, bool tail = false);
+
+static vector<Closure> compileClosures(const Node &node, size_t first,
+                                       bool tail = false) {
+  vector<Closure> closures;
+  for (size_t i = first; i < node.children.size(); i++) {
+    bool last = i + 1 == node.children.size();
+    closures.push_back(compileClosure(*node.children[i], tail && last));
+  }
+  return closures;
+}
+
+static Closure sequenceClosure(vector<Closure> body) {
+  if (body.empty()) {
+    return [](Env &) { return Value::voidValue(); };
+  }
+  if (body.size() == 1) {
+    return std::move(body[0]);
+  }
+  return [body = std::move(body)](Env &env) {
+    for (size_t i = 0; i + 1 < body.size(); i++) {
+      body[i](env);
+    }
+    return body.back()(env);
+  };
+}
+
+template <class Fn>
+static Closure operatorClosure(const Node &node, const char *symbol) {
+  vector<Closure> args = compileClosures(node, 0);
+  if (args.empty()) {
+    return [](Env &) { return Value(0.0); };
+  }
+  if (args.size() == 1) {
+    return [a = std::move(args[0]), symbol](Env &env) {
+      return Value(numberOf(a(env), symbol));
+    };
+  }
+  if (args.size() == 2 && node.children[1]->kind == NodeKind::Number) {
+    return [a = std::move(args[0]), k = node.children[1]->number,
+            symbol](Env &env) {
+      return Value(Fn::apply(numberOf(a(env), symbol), k));
+    };
+  }
+  if (args.size() == 2) {
+    return [a = std::move(args[0]), b = std::move(args[1]), symbol](Env &env) {
+      double x = numberOf(a(env), symbol);
+      return Value(Fn::apply(x, numberOf(b(env), symbol)));
+    };
+  }
+  return [args = std::move(args), symbol](Env &env) {
+    double result = numberOf(args[0](env), symbol);
+    for (size_t i = 1; i < args.size(); i++) {
+      result = Fn::apply(result, numberOf(args[i](env), symbol));
+    }
+    return Value(result);
+  };
+}
+
+static Closure compileOperator(const Node &node) {
+  int32_t op = binaryOpIndex(node.text), index = 0;
+#define CLOSURE_OP_CASE(name, symbol, result)                                  \
+  if (index++ == op) {                                                         \
+    return operatorClosure<name##Fn>(node, symbol);                            \
+  }
+  VM_BINARY_OPS(CLOSURE_OP_CASE)
+#undef CLOSURE_OP_CASE
+  throw runtime_error("Unknown operator " + string(node.text));
+}
+
+static const Closure &lambdaBody(const Node *def) {
+  static unordered_map<const Node *, Closure> bodies;
+  auto it = bodies.find(def);
+  if (it == bodies.end()) {
+    Closure body = sequenceClosure(compileClosures(*def, 0, true));
+    it = bodies.emplace(def, std::move(body)).first;
+  }
+  return it->second;
+}
+
+static PendingCall closureTail;
+
+static Value callClosure(Env &env, const LambdaObj &lambda,
+                         const Closure &body, const vector<Closure> &args) {
+  const Node *def = lambda.def;
+  checkArgCount(def, args.size());
+  Value result;
+  bool jit = jitEnabled && lambda.captured.empty();
+  if (JitCode code = jit ? jitCode(def) : nullptr) {
+    Value values[maxJitParams];
+    double params[maxJitParams];
+    bool numeric = true;
+    for (size_t i = 0; i < args.size(); i++) {
+      values[i] = args[i](env);
+      numeric = numeric && values[i].isNumber();
+      params[i] = values[i].number();
+    }
+    if (numeric) {
+      return Value(code(params));
+    }
+    Env newEnv(&env.global(), def->nameSymbols, def->starts);
+    for (size_t i = 0; i < args.size(); i++) {
+      newEnv.slot(i) = std::move(values[i]);
+    }
+    result = body(newEnv);
+  } else {
+    // Arguments are evaluated in the caller's scope, so binding each one as
+    // soon as it is ready can't be observed. The captures go first, while
+    // the lambda is sure to be alive.
+    Env newEnv = callFrame(env, lambda);
+    for (size_t i = 0; i < args.size(); i++) {
+      newEnv.slot(i) = args[i](env);
+    }
+    result = body(newEnv);
+  }
+  if (!closureTail.callee.obj()) {
+    return result;
+  }
+  return makeTailCalls(closureTail, env, [](const Node *def, Env &frame) {
+    return lambdaBody(def)(frame);
+  });
+}
+
+// Leaves a call in tail position in closureTail, with its arguments
+// evaluated here in the caller's scope.
+static Value leaveTailCall(Env &env, Value callee,
+                           const vector<Closure> &args) {
+  vector<Value> values;
+  values.reserve(args.size());
+  for (const auto &arg : args) {
+    values.push_back(arg(env));
+  }
+  closureTail.callee = std::move(callee);
+  closureTail.args = std::move(values);
+  return Value();
+}
+
+static Closure compileApply(const Node &node, bool tail) {
+  const Node &callee = *node.children[0];
+  vector<Closure> args = compileClosures(node, 1);
+
+  if (callee.kind == NodeKind::Symbol) {
+    // The body of the last lambda called here is kept next to the call.
+    return [name = &callee, args = std::move(args), tail,
+            cachedDef = static_cast<const Node *>(nullptr),
+            cachedBody = static_cast<const Closure *>(nullptr)](
+               Env &env) mutable {
+      Value *binding = findBinding(env, *name);
+      if (!binding) {
+        throw runtime_error("Undefined variable: " + string(name->text));
+      }
+      if (auto *lambda = binding->as<LambdaObj>()) {
+        if (lambda->def != cachedDef) {
+          cachedDef = lambda->def;
+          cachedBody = &lambdaBody(cachedDef);
+        }
+        if (tail) {
+          return leaveTailCall(env, *binding, args);
+        }
+        return callClosure(env, *lambda, *cachedBody, args);
+      }
+      if (!args.empty()) {
+        throw runtime_error("Cannot apply " + binding->toString());
+      }
+      return *binding;
+    };
+  }
+
+  return [callee = compileClosure(callee), args = std::move(args),
+          tail](Env &env) {
+    Value value = callee(env);
+    if (auto *lambda = value.as<LambdaObj>()) {
+      if (tail) {
+        return leaveTailCall(env, std::move(value), args);
+      }
+      return callClosure(env, *lambda, lambdaBody(lambda->def), args);
+    }
+    if (!args.empty()) {
+      throw runtime_error("Cannot apply " + value.toString());
+    }
+    return value;
+  };
+}
+
+static Closure compileClosure(const Node &node, bool tail) {
+  switch (node.kind) {
+  case NodeKind::Number:
+    return [number = node.number](Env &) { return Value(number); };
+
+  case NodeKind::String:
+    return [text = node.text](Env &) {
+      return Value(make_unique<StringObj>(text));
+    };
+
+  case NodeKind::Symbol:
+    if (node.slot >= 0) {
+      return [depth = node.depth, slot = node.slot](Env &env) {
+        return env.at(depth, slot);
+      };
+    }
+    return [name = node.text, symbol = node.symbol](Env &env) {
+      Value *binding = env.find(symbol);
+      if (!binding) {
+        throw runtime_error("Undefined variable: " + string(name));
+      }
+      return *binding;
+    };
+
+  case NodeKind::Operator:
+    return compileOperator(node);
+
+  case NodeKind::CompoundAssign:
+    return [op = node.text, target = node.children[0].get(),
+            value = compileClosure(*node.children[1]), apply = node.op,
+            divides = node.symbol == divAssign](Env &env) {
+      Value *binding = findBinding(env, *target);
+      if (!binding || !binding->isNumber()) {
+        throw runtime_error(string(op) + " requires a valid number variable");
+      }
+      Value operand = value(env);
+      if (!operand.isNumber()) {
+        throw runtime_error(string(op) + " requires a valid numeric argument");
+      }
+      if (divides && operand.number() == 0) {
+        throw runtime_error("/= cannot divide by zero");
+      }
+      // evaluating the operand may have rebound the variable
+      if (!binding->isNumber()) {
+        throw runtime_error(string(op) + " requires a valid number variable");
+      }
+      *binding = Value((*apply)(binding->number(), operand.number()));
+      return Value(binding->number());
+    };
+
+  case NodeKind::Define:
+    return [name = node.symbol,
+            value = compileClosure(*node.children[0])](Env &env) {
+      Value result = value(env);
+      env.set(name, result);
+      return result;
+    };
+
+  case NodeKind::Set:
+    return [target = &node,
+            value = compileClosure(*node.children[0])](Env &env) {
+      Value result = value(env);
+      Value *binding = findBinding(env, *target);
+      if (!binding) {
+        throw runtime_error("Variable not found for set!");
+      }
+      *binding = result;
+      return result;
+    };
+
+  case NodeKind::Begin:
+    return sequenceClosure(compileClosures(node, 0, tail));
+
+  case NodeKind::If: {
+    if (node.children.size() < 2 || node.children.size() > 3) {
+      throw runtime_error("if expects a condition and one or two branches");
+    }
+    Closure otherwise = node.children.size() == 3
+                            ? compileClosure(*node.children[2], tail)
+                            : [](Env &) { return Value(0.0); };
+    return [condition = compileClosure(*node.children[0]),
+            then = compileClosure(*node.children[1], tail),
+            otherwise = std::move(otherwise)](Env &env) {
+      return isTruthy(condition(env)) ? then(env) : otherwise(env);
+    };
+  }
+
+  case NodeKind::While: {
+    if (node.children.empty()) {
+      throw runtime_error("while expects a condition");
+    }
+    return [condition = compileClosure(*node.children[0]),
+            body = compileClosures(node, 1)](Env &env) {
+      Value lastResult(0.0);
+      while (isTruthy(condition(env))) {
+        for (const auto &expr : body) {
+          lastResult = expr(env);
+        }
+      }
+      return lastResult;
+    };
+  }
+
+  case NodeKind::Lambda:
+    return [&node](Env &env) { return makeLambda(env, node); };
+
+  case NodeKind::Let: {
+    vector<Closure> values;
+    for (size_t i = 0; i < node.names.size(); i++) {
+      values.push_back(compileClosure(*node.children[i]));
+    }
+    size_t count = node.names.size();
+    return [&node, values = std::move(values),
+            body = sequenceClosure(compileClosures(node, count, tail))](
+               Env &env) {
+      Env newEnv(&env, node.nameSymbols, node.starts);
+      for (size_t i = 0; i < values.size(); i++) {
+        newEnv.slot(i) = values[i](env);
+      }
+      return body(newEnv);
+    };
+  }
+
+  case NodeKind::Display:
+  case NodeKind::Eval:
+  case NodeKind::List:
+  case NodeKind::Get:
+  case NodeKind::Car:
+  case NodeKind::Cdr:
+  case NodeKind::Cons:
+  case NodeKind::Len:
+  case NodeKind::ToString:
+  case NodeKind::Vector:
+  case NodeKind::Push:
+  case NodeKind::SetNth:
+  case NodeKind::Concat:
+  case NodeKind::Slice:
+  case NodeKind::LenOfList:
+  case NodeKind::CarOfList:
+  case NodeKind::LenOfCons:
+  case NodeKind::CarOfCons:
+  case NodeKind::CdrOfCons:
+    return [kind = node.kind, args = compileClosures(node, 0)](Env &env) {
+      Args values;
+      values.reserve(args.size());
+      for (const auto &arg : args) {
+        values.push_back(arg(env));
+      }
+      return applyBuiltin(env, kind, values);
+    };
+
+  case NodeKind::Apply:
+    return compileApply(node, tail);
+  }
+
+  throw runtime_error("Invalid Input");
+}
+
+// Self-specializing engine: forms become trees of node objects that record
+// the types they see and rewrite themselves. A variable read that has only
+// produced numbers becomes a node that returns the raw double; an if or
+// while whose condition has only been numeric tests the double directly; a
+// call site that has only called one lambda keeps that lambda's body. When
+// another type shows up the node replaces itself with its general form.
+// Operators only ever accept numbers, so they are double-only from the
+// start and ask their operands for raw doubles through executeNumber.
+
+class SpecNode;
+using SpecPtr = shared_ptr<SpecNode>;
+
+// Thrown by executeNumber when the value turns out not to be a number.
+struct UnexpectedType {
+  Value value;
+};
+
+// Replaced nodes may still be running further up the C++ stack, so they are
+// kept until the outermost evaluation returns.
+static vector<SpecPtr> retiredNodes;
+static int specDepth = 0;
+
+class SpecNode {
+public:
+  virtual ~SpecNode() = default;
+
+  virtual Value execute(Env &env) = 0;
+
+  virtual double executeNumber(Env &env) {
+    Value value = execute(env);
+    if (!value.isNumber()) {
+      throw UnexpectedType{std::move(value)};
+    }
+    return value.number();
+  }
+
+  // Lets each node replace itself in the slot that owns it. Replacements
+  // share their children, so every new owner adopts them again.
+  static void adopt(SpecPtr &node) { node->slot = &node; }
+
+  static void adoptAll(vector<SpecPtr> &nodes) {
+    for (auto &node : nodes) {
+      adopt(node);
+    }
+  }
+
+protected:
+  SpecPtr *slot = nullptr;
+
+  SpecNode *replace(SpecPtr node) {
+    node->slot = slot;
+    retiredNodes.push_back(std::move(*slot));
+    *slot = std::move(node);
+    return slot->get();
+  }
+};
+
+// A form in tail position, whose value the lambda body returns as it is,
+// is specialized with tail set. A call there leaves itself in specTail for
+// callSpecialized to make once the frame it was made from is gone.
+static SpecPtr specialize(const Node &node, bool tail = false);
+
+// Whether child i of a form in tail position is in tail position too.
+static bool tailChild(const Node &node, size_t i) {
+  bool last = i + 1 == node.children.size();
+  switch (node.kind) {
+  case NodeKind::If:
+    return i > 0;
+  case NodeKind::Let:
+    return last && i >= node.names.size();
+  case NodeKind::Begin:
+  case NodeKind::Lambda:
+    return last;
+  default:
+    return false;
+  }
+}
+
+static vector<SpecPtr> specializeAll(const Node &node, size_t first,
+                                     bool tail = false) {
+  vector<SpecPtr> nodes;
+  for (size_t i = first; i < node.children.size(); i++) {
+    nodes.push_back(specialize(*node.children[i], tail && tailChild(node, i)));
+  }
+  return nodes;
+}
+
+static Value &lookup(Env &env, const Node &ref) {
+  Value *binding = findBinding(env, ref);
+  if (!binding) {
+    throw runtime_error("Undefined variable: " + string(ref.text));
+  }
+  return *binding;
+}
+
+static Value runSequence(const vector<SpecPtr> &body, size_t first,
+                         Env &env) {
+  if (first == body.size()) {
+    return Value::voidValue();
+  }
+  for (size_t i = first; i + 1 < body.size(); i++) {
+    body[i]->execute(env);
+  }
+  return body.back()->execute(env);
+}
+
+class SpecNumber : public SpecNode {
+public:
+  explicit SpecNumber(double value) : value(value) {}
+  Value execute(Env &) override { return Value(value); }
+  double executeNumber(Env &) override { return value; }
+
+private:
+  double value;
+};
+
+class SpecString : public SpecNode {
+public:
+  explicit SpecString(string_view text) : text(text) {}
+  Value execute(Env &) override { return Value(make_unique<StringObj>(text)); }
+
+private:
+  string_view text;
+};
+
+class SpecGenericVar : public SpecNode {
+public:
+  explicit SpecGenericVar(const Node &ref) : ref(ref) {}
+  Value execute(Env &env) override {
+    return lookup(env, ref);
+  }
+
+private:
+  const Node &ref;
+};
+
+class SpecNumberVar : public SpecNode {
+public:
+  explicit SpecNumberVar(const Node &ref) : ref(ref) {}
+
+  Value execute(Env &env) override {
+    const Value &value = lookup(env, ref);
+    if (value.isNumber()) {
+      return Value(value.number());
+    }
+    return replace(make_shared<SpecGenericVar>(ref))->execute(env);
+  }
+
+  double executeNumber(Env &env) override {
+    const Value &value = lookup(env, ref);
+    if (value.isNumber()) {
+      return value.number();
+    }
+    return replace(make_shared<SpecGenericVar>(ref))->executeNumber(env);
+  }
+
+private:
+  const Node &ref;
+};
+
+class SpecVar : public SpecNode {
+public:
+  explicit SpecVar(const Node &ref) : ref(ref) {}
+
+  Value execute(Env &env) override {
+    if (lookup(env, ref).isNumber()) {
+      return replace(make_shared<SpecNumberVar>(ref))->execute(env);
+    }
+    return replace(make_shared<SpecGenericVar>(ref))->execute(env);
+  }
+
+private:
+  const Node &ref;
+};
+
+template <class Fn> class SpecOperator : public SpecNode {
+public:
+  SpecOperator(vector<SpecPtr> args, const char *symbol)
+      : args(std::move(args)), symbol(symbol) {
+    adoptAll(this->args);
+  }
+
+  Value execute(Env &env) override { return Value(executeNumber(env)); }
+
+  double executeNumber(Env &env) override {
+    if (args.empty()) {
+      return 0;
+    }
+    try {
+      double result = args[0]->executeNumber(env);
+      for (size_t i = 1; i < args.size(); i++) {
+        result = Fn::apply(result, args[i]->executeNumber(env));
+      }
+      return result;
+    } catch (const UnexpectedType &) {
+      throw runtime_error(string(symbol) + " expects numbers");
+    }
+  }
+
+private:
+  vector<SpecPtr> args;
+  const char *symbol;
+};
+
+static SpecPtr specializeOperator(const Node &node) {
+  int32_t op = binaryOpIndex(node.text), index = 0;
+#define SPEC_OP_CASE(name, symbol, result)                                     \
+  if (index++ == op) {                                                         \
+    return make_shared<SpecOperator<name##Fn>>(specializeAll(node, 0),         \
+                                               symbol);                        \
+  }
+  VM_BINARY_OPS(SPEC_OP_CASE)
+#undef SPEC_OP_CASE
+  throw runtime_error("Unknown operator " + string(node.text));
+}
+
+class SpecCompoundAssign : public SpecNode {
+public:
+  SpecCompoundAssign(const Node &node, vector<SpecPtr> operand)
+      : node(node), operand(std::move(operand)) {
+    adoptAll(this->operand);
+  }
+
+  Value execute(Env &env) override { return Value(executeNumber(env)); }
+
+  double executeNumber(Env &env) override {
+    variable(env);
+    double value;
+    try {
+      value = operand[0]->executeNumber(env);
+    } catch (const UnexpectedType &) {
+      throw runtime_error(string(node.text) +
+                          " requires a valid numeric argument");
+    }
+    if (node.symbol == divAssign && value == 0) {
+      throw runtime_error("/= cannot divide by zero");
+    }
+    // evaluating the operand may have rebound the variable
+    Value &target = variable(env);
+    target = Value((*node.op)(target.number(), value));
+    return target.number();
+  }
+
+private:
+  const Node &node;
+  vector<SpecPtr> operand;
+
+  Value &variable(Env &env) {
+    Value *binding = findBinding(env, *node.children[0]);
+    if (!binding || !binding->isNumber()) {
+      throw runtime_error(string(node.text) +
+                          " requires a valid number variable");
+    }
+    return *binding;
+  }
+};
+
+class SpecGenericSet : public SpecNode {
+public:
+  SpecGenericSet(const Node &ref, vector<SpecPtr> value)
+      : ref(ref), value(std::move(value)) {
+    adoptAll(this->value);
+  }
+
+  Value execute(Env &env) override {
+    return assign(env, ref, value[0]->execute(env));
+  }
+
+  static Value assign(Env &env, const Node &ref, Value value) {
+    Value *binding = findBinding(env, ref);
+    if (!binding) {
+      throw runtime_error("Variable not found for set!");
+    }
+    *binding = value;
+    return value;
+  }
+
+private:
+  const Node &ref;
+  vector<SpecPtr> value;
+};
+
+// Numbers are stored into the binding without touching reference counts.
+class SpecNumberSet : public SpecNode {
+public:
+  SpecNumberSet(const Node &ref, vector<SpecPtr> value)
+      : ref(ref), value(std::move(value)) {
+    adoptAll(this->value);
+  }
+
+  Value execute(Env &env) override {
+    double number;
+    try {
+      number = value[0]->executeNumber(env);
+    } catch (UnexpectedType &unexpected) {
+      replace(make_shared<SpecGenericSet>(ref, value));
+      return SpecGenericSet::assign(env, ref, std::move(unexpected.value));
+    }
+    Value *binding = findBinding(env, ref);
+    if (!binding) {
+      throw runtime_error("Variable not found for set!");
+    }
+    *binding = Value(number);
+    return Value(number);
+  }
+
+private:
+  const Node &ref;
+  vector<SpecPtr> value;
+};
+
+class SpecGenericIf : public SpecNode {
+public:
+  explicit SpecGenericIf(vector<SpecPtr> parts) : parts(std::move(parts)) {
+    adoptAll(this->parts);
+  }
+
+  Value execute(Env &env) override {
+    return branch(env, parts, isTruthy(parts[0]->execute(env)));
+  }
+
+  static Value branch(Env &env, const vector<SpecPtr> &parts, bool truthy) {
+    if (truthy) {
+      return parts[1]->execute(env);
+    }
+    return parts.size() == 3 ? parts[2]->execute(env) : Value(0.0);
+  }
+
+private:
+  vector<SpecPtr> parts;
+};
+
+class SpecNumberIf : public SpecNode {
+public:
+  explicit SpecNumberIf(vector<SpecPtr> parts) : parts(std::move(parts)) {
+    adoptAll(this->parts);
+  }
+
+  Value execute(Env &env) override {
+    bool truthy;
+    try {
+      truthy = parts[0]->executeNumber(env) != 0;
+    } catch (const UnexpectedType &unexpected) {
+      replace(make_shared<SpecGenericIf>(parts));
+      truthy = isTruthy(unexpected.value);
+    }
+    return SpecGenericIf::branch(env, parts, truthy);
+  }
+
+private:
+  vector<SpecPtr> parts;
+};
+
+class SpecGenericWhile : public SpecNode {
+public:
+  explicit SpecGenericWhile(vector<SpecPtr> parts)
+      : parts(std::move(parts)) {
+    adoptAll(this->parts);
+  }
+
+  Value execute(Env &env) override {
+    Value lastResult(0.0);
+    while (isTruthy(parts[0]->execute(env))) {
+      body(env, parts, lastResult);
+    }
+    return lastResult;
+  }
+
+  static void body(Env &env, const vector<SpecPtr> &parts, Value &last) {
+    for (size_t i = 1; i < parts.size(); i++) {
+      last = parts[i]->execute(env);
+    }
+  }
+
+private:
+  vector<SpecPtr> parts;
+};
+
+class SpecNumberWhile : public SpecNode {
+public:
+  explicit SpecNumberWhile(vector<SpecPtr> parts)
+      : parts(std::move(parts)) {
+    adoptAll(this->parts);
+  }
+
+  Value execute(Env &env) override {
+    Value lastResult(0.0);
+    while (true) {
+      try {
+        if (parts[0]->executeNumber(env) == 0) {
+          return lastResult;
+        }
+      } catch (const UnexpectedType &) {
+        // Non-numbers are falsy, and the general loop takes over from here.
+        replace(make_shared<SpecGenericWhile>(parts));
+        return lastResult;
+      }
+      SpecGenericWhile::body(env, parts, lastResult);
+    }
+  }
+
+private:
+  vector<SpecPtr> parts;
+};
+
+class SpecDefine : public SpecNode {
+public:
+  SpecDefine(Symbol name, vector<SpecPtr> value)
+      : name(name), value(std::move(value)) {
+    adoptAll(this->value);
+  }
+
+  Value execute(Env &env) override {
+    Value result = value[0]->execute(env);
+    env.set(name, result);
+    return result;
+  }
+
+private:
+  Symbol name;
+  vector<SpecPtr> value;
+};
+
+class SpecBegin : public SpecNode {
+public:
+  explicit SpecBegin(vector<SpecPtr> body) : body(std::move(body)) {
+    adoptAll(this->body);
+  }
+  Value execute(Env &env) override { return runSequence(body, 0, env); }
+
+private:
+  vector<SpecPtr> body;
+};
+
+class SpecLet : public SpecNode {
+public:
+  SpecLet(const Node &node, vector<SpecPtr> parts)
+      : node(node), parts(std::move(parts)) {
+    adoptAll(this->parts);
+  }
+
+  Value execute(Env &env) override {
+    Env newEnv(&env, node.nameSymbols, node.starts);
+    for (size_t i = 0; i < node.names.size(); i++) {
+      newEnv.slot(i) = parts[i]->execute(env);
+    }
+    return runSequence(parts, node.names.size(), newEnv);
+  }
+
+private:
+  const Node &node;
+  vector<SpecPtr> parts;
+};
+
+class SpecLambda : public SpecNode {
+public:
+  explicit SpecLambda(const Node &node) : node(node) {}
+
+  Value execute(Env &env) override { return makeLambda(env, node); }
+
+private:
+  const Node &node;
+};
+
+class SpecBuiltin : public SpecNode {
+public:
+  SpecBuiltin(NodeKind kind, vector<SpecPtr> args)
+      : kind(kind), args(std::move(args)) {
+    adoptAll(this->args);
+  }
+
+  Value execute(Env &env) override {
+    Args values;
+    values.reserve(args.size());
+    for (const auto &arg : args) {
+      values.push_back(arg->execute(env));
+    }
+    return applyBuiltin(env, kind, values);
+  }
+
+private:
+  NodeKind kind;
+  vector<SpecPtr> args;
+};
+
+static const vector<SpecPtr> &specializedBody(const Node *def) {
+  static unordered_map<const Node *, vector<SpecPtr>> bodies;
+  auto it = bodies.find(def);
+  if (it == bodies.end()) {
+    it = bodies.emplace(def, specializeAll(*def, 0, true)).first;
+    SpecNode::adoptAll(it->second);
+  }
+  return it->second;
+}
+
+static PendingCall specTail;
+
+// Calls def with the arguments parts[1..].
+static Value callSpecialized(Env &env, const LambdaObj &lambda,
+                             const vector<SpecPtr> &parts) {
+  const Node *def = lambda.def;
+  size_t argc = parts.size() - 1;
+  checkArgCount(def, argc);
+  Value result;
+  bool jit = jitEnabled && lambda.captured.empty();
+  if (JitCode code = jit ? jitCode(def) : nullptr) {
+    Value values[maxJitParams];
+    double params[maxJitParams];
+    bool numeric = true;
+    for (size_t i = 0; i < argc; i++) {
+      values[i] = parts[i + 1]->execute(env);
+      numeric = numeric && values[i].isNumber();
+      params[i] = values[i].number();
+    }
+    if (numeric) {
+      return Value(code(params));
+    }
+    Env newEnv(&env.global(), def->nameSymbols, def->starts);
+    for (size_t i = 0; i < argc; i++) {
+      newEnv.slot(i) = std::move(values[i]);
+    }
+    result = runSequence(specializedBody(def), 0, newEnv);
+  } else {
+    // The captures go first, while the lambda is sure to be alive.
+    Env newEnv = callFrame(env, lambda);
+    for (size_t i = 0; i < argc; i++) {
+      newEnv.slot(i) = parts[i + 1]->execute(env);
+    }
+    result = runSequence(specializedBody(def), 0, newEnv);
+  }
+  if (!specTail.callee.obj()) {
+    return result;
+  }
+  return makeTailCalls(specTail, env, [](const Node *def, Env &frame) {
+    return runSequence(specializedBody(def), 0, frame);
+  });
+}
+
+// Leaves the call of callee with the arguments parts[1..] in specTail,
+// or makes it when it is not in tail position.
+static Value callSpecialized(Env &env, Value callee,
+                             const vector<SpecPtr> &parts, bool tail) {
+  if (!tail) {
+    return callSpecialized(env, *callee.as<LambdaObj>(), parts);
+  }
+  vector<Value> args;
+  args.reserve(parts.size() - 1);
+  for (size_t i = 1; i < parts.size(); i++) {
+    args.push_back(parts[i]->execute(env));
+  }
+  specTail.callee = std::move(callee);
+  specTail.args = std::move(args);
+  return Value();
+}
+
+class SpecGenericCall : public SpecNode {
+public:
+  explicit SpecGenericCall(vector<SpecPtr> parts,
+                           const Node *callee = nullptr, bool tail = false)
+      : parts(std::move(parts)), callee(callee), tail(tail) {
+    adoptAll(this->parts);
+  }
+
+  Value execute(Env &env) override {
+    Value value = callee ? lookup(env, *callee)
+                         : parts[0]->execute(env);
+    if (value.as<LambdaObj>()) {
+      return callSpecialized(env, std::move(value), parts, tail);
+    }
+    if (parts.size() > 1) {
+      throw runtime_error("Cannot apply " + value.toString());
+    }
+    return value;
+  }
+
+private:
+  vector<SpecPtr> parts;
+  const Node *callee;
+  bool tail;
+};
+
+// A call site that has only ever called def through the variable name.
+class SpecCachedCall : public SpecNode {
+public:
+  SpecCachedCall(vector<SpecPtr> parts, const Node &callee, const Node *def,
+                 bool tail)
+      : parts(std::move(parts)), callee(callee), def(def), tail(tail) {
+    adoptAll(this->parts);
+  }
+
+  Value execute(Env &env) override {
+    const Value &value = lookup(env, callee);
+    auto *lambda = value.as<LambdaObj>();
+    if (!lambda || lambda->def != def) {
+      return replace(make_shared<SpecGenericCall>(parts, &callee, tail))
+          ->execute(env);
+    }
+    if (tail) {
+      return callSpecialized(env, value, parts, true);
+    }
+    return callSpecialized(env, *lambda, parts);
+  }
+
+private:
+  vector<SpecPtr> parts;
+  const Node &callee;
+  const Node *def;
+  bool tail;
+};
+
+class SpecCall : public SpecNode {
+public:
+  SpecCall(vector<SpecPtr> parts, const Node &callee, bool tail)
+      : parts(std::move(parts)), callee(callee), tail(tail) {
+    adoptAll(this->parts);
+  }
+
+  Value execute(Env &env) override {
+    auto *lambda = lookup(env, callee).as<LambdaObj>();
+    if (lambda) {
+      return replace(make_shared<SpecCachedCall>(parts, callee, lambda->def,
+                                                 tail))
+          ->execute(env);
+    }
+    return replace(make_shared<SpecGenericCall>(parts, &callee, tail))
+        ->execute(env);
+  }
+
+private:
+  vector<SpecPtr> parts;
+  const Node &callee;
+  bool tail;
+};
+
+static SpecPtr specialize(const Node &node, bool tail) {
+  switch (node.kind) {
+  case NodeKind::Number:
+    return make_shared<SpecNumber>(node.number);
+
+  case NodeKind::String:
+    return make_shared<SpecString>(node.text);
+
+  case NodeKind::Symbol:
+    return make_shared<SpecVar>(node);
+
+  case NodeKind::Operator:
+    return specializeOperator(node);
+
+  case NodeKind::CompoundAssign:
+    return make_shared<SpecCompoundAssign>(node, specializeAll(node, 1));
+
+  case NodeKind::Define:
+    return make_shared<SpecDefine>(node.symbol, specializeAll(node, 0));
+
+  case NodeKind::Begin:
+    return make_shared<SpecBegin>(specializeAll(node, 0, tail));
+
+  case NodeKind::If:
+    if (node.children.size() < 2 || node.children.size() > 3) {
+      throw runtime_error("if expects a condition and one or two branches");
+    }
+    return make_shared<SpecNumberIf>(specializeAll(node, 0, tail));
+
+  case NodeKind::While:
+    if (node.children.empty()) {
+      throw runtime_error("while expects a condition");
+    }
+    return make_shared<SpecNumberWhile>(specializeAll(node, 0));
+
+  case NodeKind::Lambda:
+    return make_shared<SpecLambda>(node);
+
+  case NodeKind::Let:
+    return make_shared<SpecLet>(node, specializeAll(node, 0, tail));
+
+  case NodeKind::Set:
+    return make_shared<SpecNumberSet>(node, specializeAll(node, 0));
+
+  case NodeKind::Apply: {
+    const Node &callee = *node.children[0];
+    if (callee.kind == NodeKind::Symbol) {
+      return make_shared<SpecCall>(specializeAll(node, 0), callee, tail);
+    }
+    return make_shared<SpecGenericCall>(specializeAll(node, 0), nullptr,
+                                        tail);
+  }
+
+  default:
+    return make_shared<SpecBuiltin>(node.kind, specializeAll(node, 0));
+  }
+}
+
+static Value runSpecialized(Env &env, const Node &form) {
+  SpecPtr root = specialize(form);
+  SpecNode::adopt(root);
+  specDepth++;
+  try {
+    Value result = root->execute(env);
+    if (--specDepth == 0) {
+      retiredNodes.clear();
+    }
+    return result;
+  } catch (...) {
+    if (--specDepth == 0) {
+      retiredNodes.clear();
+    }
+    throw;
+  }
+}
+
+// Stackless engine: a tree walker that keeps its control stack on the heap
+// instead of recursing in C++. Every pending form is a task on a growable
+// vector, the results it waits for sit on a value stack and the frames and
+// let scopes it opens live in a deque, so nesting is only bounded by
+// memory. A form in tail position takes over the task of the form around
+// it, and a tail call takes over that task's scopes as well.
+class StacklessMachine {
+public:
+  Value run(Env &env, const Node &form) {
+    push(form, env);
+    while (!tasks.empty()) {
+      step();
+    }
+    return std::move(values.back());
+  }
+
+private:
+  struct Task {
+    const Node *node;
+    Env *env;
+    size_t base;       // Values below this belong to the tasks below
+    size_t scopes;     // And so do the scopes below this
+    size_t step = 0;   // How far the form has got
+    bool body = false; // Runs node's children[step..] as a body
+    Env *defining = nullptr; // Compound assignment: the variable's scope
+  };
+
+  vector<Task> tasks;
+  vector<Value> values;
+  deque<Env> scopes;
+
+  void push(const Node &node, Env &env) {
+    tasks.push_back({&node, &env, values.size(), scopes.size()});
+  }
+
+  // Starts the next child of the current task, which resumes when the
+  // child's value is on the stack. Pushing moves the task, so this is the
+  // last thing a step does.
+  void evalChild(const Node &child) {
+    Task &task = tasks.back();
+    task.step++;
+    push(child, *task.env);
+  }
+
+  // Evaluates node in place of the current task.
+  void evalTail(const Node &node, Env &env) {
+    Task &task = tasks.back();
+    values.resize(task.base);
+    task.node = &node;
+    task.env = &env;
+    task.step = 0;
+    task.body = false;
+  }
+
+  void finish(Value result) {
+    Task &task = tasks.back();
+    values.resize(task.base);
+    scopes.erase(scopes.begin() + task.scopes, scopes.end());
+    tasks.pop_back();
+    values.push_back(std::move(result));
+  }
+
+  Value pop() {
+    Value value = std::move(values.back());
+    values.pop_back();
+    return value;
+  }
+
+  void step();
+  void stepBody(Task &task);
+  void stepWhile(Task &task);
+  void stepApply(Task &task);
+};
 
-  Env(const Env &) = delete;
-  Env &operator=(const Env &) = delete;
+void StacklessMachine::stepBody(Task &task) {
+  const auto &children = task.node->children;
+  values.resize(task.base);
+  if (task.step == children.size()) {
+    finish(Value::voidValue());
+  } else if (task.step + 1 == children.size()) {
+    evalTail(*children.back(), *task.env);
+  } else {
+    evalChild(*children[task.step]);
+  }
+}
 
-  Env(Env &&) = default;
-  Env &operator=(Env &&) = default;
+// Steps count what finished last: 1 is the condition, k > 1 is body form
+// k - 1. The latest body result waits at the base of the task.
+void StacklessMachine::stepWhile(Task &task) {
+  const Node &node = *task.node;
+  size_t next = node.children.size();
+  if (task.step == 0) {
+    if (node.children.empty()) {
+      throw runtime_error("while expects a condition");
+    }
+    values.push_back(Value(0.0));
+  } else if (task.step == 1) {
+    if (!isTruthy(pop())) {
+      finish(pop());
+      return;
+    }
+    next = 1;
+  } else {
+    values[task.base] = pop();
+    next = task.step;
+  }
 
-  bool contains(string_view name) const {
-    return values.count(name) > 0 || (parent && parent->contains(name));
+  if (next < node.children.size()) {
+    task.step = next;
+    evalChild(*node.children[next]);
+    return;
+  }
+  LoopState *trace = tracingEnabled ? &loopState(&node) : nullptr;
+  if (trace && runLoopTrace(*task.env, node, *trace, values[task.base])) {
+    finish(pop());
+    return;
   }
+  task.step = 0;
+  evalChild(*node.children[0]);
+}
 
-  bool containsLocal(string_view name) const { return values.count(name) > 0; }
+// Step 0 looks the callee up, then step k has evaluated k - 1 arguments.
+void StacklessMachine::stepApply(Task &task) {
+  const Node &node = *task.node;
+  const Node &callee = *node.children[0];
+  if (task.step == 0) {
+    if (callee.kind != NodeKind::Symbol) {
+      evalChild(callee);
+      return;
+    }
+    Value *binding = findBinding(*task.env, callee);
+    if (!binding) {
+      throw runtime_error("Undefined variable: " + string(callee.text));
+    }
+    values.push_back(*binding);
+    task.step = 1;
+  }
 
-  const Obj *get(string_view name) const {
-    auto it = values.find(name);
-    if (it != values.end()) {
-      return it->second.get();
+  auto *lambda = values[task.base].as<LambdaObj>();
+  if (!lambda) {
+    if (node.children.size() == 1) {
+      finish(pop());
+      return;
     }
-    return parent ? parent->get(name) : nullptr;
+    throw runtime_error("Cannot apply " + values[task.base].toString());
+  }
+  const Node *def = lambda->def;
+  size_t argc = def->names.size();
+  if (node.children.size() - 1 != argc) {
+    throw runtime_error("lambda expects " + to_string(argc) +
+                        " argument(s)");
+  }
+  if (task.step <= argc) {
+    evalChild(*node.children[task.step]);
+    return;
   }
 
-  void set(string_view name, unique_ptr<Obj> value) {
-    storage.push_back(string(name));           // Store the string
-    values[storage.back()] = std::move(value); // Use the stored string's view
+  Value *args = &values[task.base + 1];
+  bool jit = jitEnabled && lambda->captured.empty();
+  if (JitCode code = jit ? jitCode(def) : nullptr) {
+    double params[maxJitParams];
+    size_t numbers = 0;
+    for (; numbers < argc && args[numbers].isNumber(); numbers++) {
+      params[numbers] = args[numbers].number();
+    }
+    if (numbers == argc) {
+      finish(Value(code(params)));
+      return;
+    }
   }
+  Env frame(&task.env->global(), def->nameSymbols, def->starts);
+  bindCaptures(frame, *lambda);
+  for (size_t i = 0; i < argc; i++) {
+    frame.slot(i) = std::move(args[i]);
+  }
+  values.resize(task.base);
+  // The call is all that is left of the task, so its frame replaces the
+  // scopes the task opened.
+  scopes.erase(scopes.begin() + task.scopes, scopes.end());
+  scopes.push_back(std::move(frame));
+  task.node = def;
+  task.env = &scopes.back();
+  task.step = 0;
+  task.body = true;
+}
 
-  unique_ptr<Obj> getClone(string_view name) const {
-    const Obj *obj = get(name);
-    return obj ? obj->clone() : nullptr;
+void StacklessMachine::step() {
+  Task &task = tasks.back();
+  if (task.body) {
+    stepBody(task);
+    return;
   }
+  const Node &node = *task.node;
+  Env &env = *task.env;
+  switch (node.kind) {
+  case NodeKind::Number:
+    finish(Value(node.number));
+    return;
 
-  bool setExisting(string_view name, unique_ptr<Obj> value) {
-    if (values.count(name) > 0) {
-      values[name] = std::move(value);
-      return true;
+  case NodeKind::String:
+    finish(Value(make_unique<StringObj>(node.text)));
+    return;
+
+  case NodeKind::Symbol: {
+    auto *binding = findBinding(env, node);
+    if (!binding) {
+      throw runtime_error("Undefined variable: " + string(node.text));
     }
-    return parent ? parent->setExisting(name, std::move(value)) : false;
+    finish(*binding);
+    return;
   }
 
-  Env *findDefiningScope(string_view name) {
-    if (values.count(name) > 0) {
-      return this;
+  case NodeKind::Operator: {
+    if (task.step > 0 && !values.back().isNumber()) {
+      throw runtime_error(string(node.text) + " expects numbers");
     }
-    return parent ? parent->findDefiningScope(name) : nullptr;
+    if (task.step < node.children.size()) {
+      evalChild(*node.children[task.step]);
+      return;
+    }
+    double result = node.children.empty() ? 0 : values[task.base].number();
+    for (size_t i = 1; i < node.children.size(); i++) {
+      result = (*node.op)(result, values[task.base + i].number());
+    }
+    finish(Value(result));
+    return;
   }
-};
 
-string_view getNextToken(size_t &pos, const string_view expr) {
-    // Skip whitespace
-    while (pos < expr.size() && isspace(expr[pos])) {
-        pos++;
+  case NodeKind::CompoundAssign: {
+    const Node &target = *node.children[0];
+    if (task.step == 0) {
+      auto *binding = findBinding(env, target);
+      if (!binding || !binding->isNumber()) {
+        throw runtime_error(string(node.text) +
+                            " requires a valid number variable");
+      }
+      if (target.slot < 0) {
+        task.defining = env.findDefiningScope(target.symbol);
+      }
+      evalChild(*node.children[1]);
+      return;
     }
-    
-    // End of string
-    if (pos >= expr.size()) {
-        return {};
+
+    Value operand = pop();
+    if (!operand.isNumber()) {
+      throw runtime_error(string(node.text) +
+                          " requires a valid numeric argument");
     }
-    
-    // Check for comment enclosed in backticks
-    if (expr[pos] == '`') {
-        // Find the closing backtick
-        size_t end = expr.find('`', pos + 1);
-        if (end != string_view::npos) {
-            // Skip entire comment and subsequent non-` characters
-            pos = end + 1;
-            while (pos < expr.size() && expr[pos] != '`') {
-                pos++;
-            }
-            
-            // Continue finding next token
-            while (pos < expr.size() && isspace(expr[pos])) {
-                pos++;
-            }
-            
-            if (pos >= expr.size()) {
-                return {};
-            }
-        }
+    if (node.symbol == divAssign && operand.number() == 0) {
+      throw runtime_error("/= cannot divide by zero");
     }
-    
-    // Check for single-character tokens/keywords
-    if (find(keywords.begin(), keywords.end(), expr[pos]) != keywords.end()) {
-        return expr.substr(pos++, 1);
+    // evaluating the operand may have rebound the variable
+    auto *binding = task.defining ? task.defining->find(target.symbol)
+                                  : findBinding(env, target);
+    if (!binding->isNumber()) {
+      throw runtime_error(string(node.text) +
+                          " requires a valid number variable");
     }
-    
-    // Extract multi-character token
-    size_t start = pos;
-    while (pos < expr.size() && 
-           !isspace(expr[pos]) && 
-           expr[pos] != '(' && 
-           expr[pos] != ')' && 
-           expr[pos] != '`') {
-        pos++;
+    *binding = Value((*node.op)(binding->number(), operand.number()));
+    finish(Value(binding->number()));
+    return;
+  }
+
+  case NodeKind::Define:
+    if (task.step == 0) {
+      evalChild(*node.children[0]);
+      return;
     }
-    
-    return expr.substr(start, pos - start);
-}
+    env.set(node.symbol, values.back());
+    finish(pop());
+    return;
 
-void skipExpr(size_t &pos, const string_view expr) {
-  while (pos < expr.size() && isspace(expr[pos])) {
-    pos++;
-  }
+  case NodeKind::Begin:
+    task.body = true;
+    stepBody(task);
+    return;
 
-  if (pos >= expr.size()) {
+  case NodeKind::If:
+    if (node.children.size() < 2 || node.children.size() > 3) {
+      throw runtime_error("if expects a condition and one or two branches");
+    }
+    if (task.step == 0) {
+      evalChild(*node.children[0]);
+    } else if (isTruthy(values.back())) {
+      evalTail(*node.children[1], env);
+    } else if (node.children.size() == 3) {
+      evalTail(*node.children[2], env);
+    } else {
+      finish(Value(0.0));
+    }
     return;
-  }
 
-  if (expr[pos] == '(') {
-    pos++;
-    int bracketCount = 1;
+  case NodeKind::While:
+    stepWhile(task);
+    return;
 
-    while (pos < expr.size() && bracketCount > 0) {
-      if (expr[pos] == '(') {
-        bracketCount++;
-      } else if (expr[pos] == ')') {
-        bracketCount--;
-      }
-      pos++;
+  case NodeKind::Lambda:
+    finish(makeLambda(env, node));
+    return;
+
+  case NodeKind::Let: {
+    size_t count = node.names.size();
+    if (task.step < count) {
+      evalChild(*node.children[task.step]);
+      return;
     }
+    Env &scope = scopes.emplace_back(&env, node.nameSymbols, node.starts);
+    for (size_t i = 0; i < count; i++) {
+      scope.slot(i) = std::move(values[task.base + i]);
+    }
+    task.env = &scope;
+    task.body = true;
+    stepBody(task);
+    return;
+  }
 
-    if (bracketCount > 0) {
-      throw runtime_error("Unmatched parentheses");
+  case NodeKind::Set: {
+    if (task.step == 0) {
+      evalChild(*node.children[0]);
+      return;
     }
-  } else {
-    getNextToken(pos, expr);
+    Value newValue = pop();
+    if (node.slot >= 0) {
+      env.at(node.depth, node.slot) = newValue;
+    } else if (!env.setExisting(node.symbol, newValue)) {
+      throw runtime_error("Variable not found for set!");
+    }
+    finish(std::move(newValue));
+    return;
   }
-}
 
-ObjPtr evalExpr(Env &env, size_t &pos, const string_view expr) {
-  string_view token = getNextToken(pos, expr);
+  case NodeKind::Display:
+  case NodeKind::Eval:
+  case NodeKind::List:
+  case NodeKind::Get:
+  case NodeKind::Car:
+  case NodeKind::Cdr:
+  case NodeKind::Cons:
+  case NodeKind::Len:
+  case NodeKind::ToString:
+  case NodeKind::Vector:
+  case NodeKind::Push:
+  case NodeKind::SetNth:
+  case NodeKind::Concat:
+  case NodeKind::Slice:
+  case NodeKind::LenOfList:
+  case NodeKind::CarOfList:
+  case NodeKind::LenOfCons:
+  case NodeKind::CarOfCons:
+  case NodeKind::CdrOfCons: {
+    if (task.step < node.children.size()) {
+      evalChild(*node.children[task.step]);
+      return;
+    }
+    Args args(make_move_iterator(values.begin() + task.base),
+              make_move_iterator(values.end()));
+    finish(applyBuiltin(env, node.kind, args));
+    return;
+  }
 
-  if (token.empty()) {
-    return nullptr;
+  case NodeKind::Apply:
+    stepApply(task);
+    return;
   }
 
-  if (token == "+=" || token == "-=" || token == "/=" || token == "*=") {
-      string_view objName = getNextToken(pos, expr);
-      string_view numberToken = getNextToken(pos, expr);
+  throw runtime_error("Invalid Input");
+}
 
-      // Retrieve current value
-      auto oldObj = env.getClone(objName);
-      NumberObj* old = dynamic_cast<NumberObj*>(oldObj.get());
-      if (!old) {
-          throw runtime_error(string(token) + " requires a valid number variable");
-      }
+// Ahead-of-time compilation: --emit-cpp translates a whole script into a
+// standalone C++ program. Top-level numbers and strings become typed
+// globals, parameters and let bindings typed locals, lambdas bound by a
+// top-level define become C++ functions over doubles and while loops become
+// native loops. Only the statically typed subset is accepted; lists, eval
+// and lambdas used as values are reported instead of compiled.
 
-      // Parse the new number and perform the operation
-      try {
-          double number = stod(string(numberToken));
-          double newValue;
-
-          if (token == "+=") {
-              newValue = old->value + number;
-          } else if (token == "-=") {
-              newValue = old->value - number;
-          } else if (token == "/=") {
-              if (number == 0) {
-                  throw runtime_error("/= cannot divide by zero");
-              }
-              newValue = old->value / number;
-          } else if (token == "*=") {
-              newValue = old->value * number;
-          } else {
-              throw runtime_error("Unsupported operation: " + string(token));
-          }
-
-          // Set the updated value in the environment
-          env.set(objName, make_unique<NumberObj>(newValue));
-          return make_unique<NumberObj>(newValue);
-      } catch (const invalid_argument&) {
-          throw runtime_error(string(token) + " requires a valid numeric argument");
-      }
-  }
-
-
-  if (token == "(") {
-    auto result = evalExpr(env, pos, expr);
-    getNextToken(pos, expr);
-    return result;
-  }
+enum class CppType { Number, String, Void, Lambda };
 
-  if (!token.empty() &&
-      (isdigit(token[0]) || (token[0] == '-' && token.length() > 1))) {
-    try {
-      return make_unique<NumberObj>(stod(string(token)));
-    } catch (...) {
-      return nullptr;
+struct CppValue {
+  CppType type = CppType::Void;
+  string expr;
+};
+
+struct CppVariable {
+  CppType type;
+  string name;
+};
+
+struct CppFunction {
+  const Node *def = nullptr;
+  string name;
+  CppType result = CppType::Number;
+  bool compiled = false, compiling = false, recursive = false;
+};
+
+class CppTranspiler {
+public:
+  string translate(string_view source) {
+    Reader reader(source);
+    out = &mainBody;
+    while (const Node *form = reader.read()) {
+      gen(*form, Mode::Echo);
     }
+    return "// Generated by cppLisp --emit-cpp\n"
+           "#include <cmath>\n"
+           "#include <iostream>\n"
+           "#include <stdexcept>\n"
+           "#include <string>\n\n"
+           "using namespace std;\n\n"
+           "// Prints NaN the one way the interpreter does.\n"
+           "static string show(double number) {\n"
+           "  return to_string(isnan(number) ? NAN : number);\n"
+           "}\n\n" +
+           declarations + "\n" + prototypes + "\n" + definitions +
+           "static void run() {\n" + mainBody +
+           "}\n\n"
+           "int main() {\n"
+           "  try {\n"
+           "    run();\n"
+           "  } catch (const exception &e) {\n"
+           "    cout << \"Error: \" << e.what() << endl;\n"
+           "    return 1;\n"
+           "  }\n"
+           "  return 0;\n"
+           "}\n";
   }
 
-  if (operators.count(token) > 0) {
-    auto op = operators.at(token);
-    vector<double> numbers;
+private:
+  // Use keeps the value, Discard drops it and Echo prints it the way the
+  // REPL prints the result of a top-level form.
+  enum class Mode { Use, Discard, Echo };
 
-    while (true) {
-      auto nextObj = evalExpr(env, pos, expr);
-      if (!nextObj)
-        break;
+  using Scope = unordered_map<string_view, CppVariable>;
 
-      if (auto *numObj = dynamic_cast<NumberObj *>(nextObj.get())) {
-        numbers.push_back(numObj->value);
-      }
+  string declarations, prototypes, definitions, mainBody;
+  string *out = nullptr;
+  int depth = 1;
+  size_t names = 0;
+  unordered_map<string_view, CppVariable> globals;
+  unordered_map<string_view, CppFunction> functions;
+  vector<Scope> scopes;
+  bool inFunction = false;
 
-      string_view next = getNextToken(pos, expr);
-      if (next == ")")
-        break;
-      pos -= next.length();
+  static string mangle(const char *prefix, string_view name) {
+    static const char digits[] = "0123456789abcdef";
+    string result = prefix;
+    for (unsigned char c : name) {
+      if (isalnum(c)) {
+        result += static_cast<char>(c);
+      } else {
+        result += {'_', digits[c >> 4], digits[c & 15]};
+      }
     }
+    return result;
+  }
 
-    if (numbers.empty()) {
-      return make_unique<NumberObj>(0);
+  static string quote(string_view text) {
+    string result = "\"";
+    for (unsigned char c : text) {
+      if (c == '"' || c == '\\') {
+        result += {'\\', static_cast<char>(c)};
+      } else if (c < 0x20 || c == 0x7F) {
+        result += {'\\', static_cast<char>('0' + (c >> 6)),
+                   static_cast<char>('0' + (c >> 3 & 7)),
+                   static_cast<char>('0' + (c & 7))};
+      } else {
+        result += static_cast<char>(c);
+      }
     }
+    return result + "\"";
+  }
 
-    double result = numbers[0];
-    for (size_t i = 1; i < numbers.size(); i++) {
-      result = op(result, numbers[i]);
+  static string literal(double value) {
+    if (isnan(value)) {
+      return "NAN";
+    }
+    if (isinf(value)) {
+      return value > 0 ? "INFINITY" : "-INFINITY";
     }
-    return make_unique<NumberObj>(result);
+    char text[32];
+    snprintf(text, sizeof(text), "%.17g", value);
+    string result = text;
+    if (result.find_first_of(".e") == string::npos) {
+      result += ".0";
+    }
+    return result;
   }
 
-  if (token == "\"") {
-    size_t start = pos;
-    while (pos < expr.size() && expr[pos] != '\"') {
-      pos++;
-    }
-    string_view str = expr.substr(start, pos - start);
-    pos++;
-    return make_unique<StringObj>(str);
+  static const char *declaration(CppType type) {
+    return type == CppType::Number ? "double " : "string ";
   }
 
-  if (token == "define") {
-    string_view name = getNextToken(pos, expr);
-    auto value = evalExpr(env, pos, expr);
-    if (value) {
-      env.set(name, value->clone());
-      return value;
-    }
-    return nullptr;
+  static bool isData(CppType type) {
+    return type == CppType::Number || type == CppType::String;
   }
 
-  if (token == "begin") {
-    unique_ptr<Obj> lastResult;
-    while (true) {
-      auto result = evalExpr(env, pos, expr);
-      if (!result)
-        break;
-      lastResult = std::move(result);
+  void line(const string &text) {
+    *out += string(depth * 2, ' ') + text + "\n";
+  }
 
-      string_view next = getNextToken(pos, expr);
-      if (next == ")")
-        break;
-      pos -= next.length();
-    }
-    return lastResult ? std::move(lastResult) : make_unique<VoidObj>();
+  string fresh(const char *prefix) { return prefix + to_string(names++); }
+
+  CppValue temp(CppType type, const string &expr) {
+    string name = fresh("t");
+    line(declaration(type) + name + " = " + expr + ";");
+    return {type, name};
   }
 
-  if (token == "display") {
-    auto value = evalExpr(env, pos, expr);
-    if (value) {
-      if (auto *strObj = dynamic_cast<StringObj *>(value.get())) {
-        cout << strObj->value << endl;
-      } else {
-        cout << value->toString() << endl;
-      }
+  // Generates node into code one level deeper than the current output.
+  CppValue nested(const Node &node, Mode mode, string &code) {
+    string *outer = out;
+    out = &code;
+    depth++;
+    CppValue value = gen(node, mode);
+    depth--;
+    out = outer;
+    return value;
+  }
+
+  void assign(const string &name, const CppValue &value) {
+    if (!name.empty()) {
+      depth++;
+      line(name + " = " + value.expr + ";");
+      depth--;
     }
-    return make_unique<VoidObj>();
   }
 
-  if (token == "if") {
-    auto condition = evalExpr(env, pos, expr);
-    if (!condition) {
-      return nullptr;
+  void print(const CppValue &value) {
+    switch (value.type) {
+    case CppType::Number:
+      line("cout << show(" + value.expr + ") << '\\n';");
+      break;
+    case CppType::String:
+      line("cout << \"\\\"\" << " + value.expr + " << \"\\\"\\n\";");
+      break;
+    case CppType::Lambda:
+      line("cout << " + value.expr + " << '\\n';");
+      break;
+    case CppType::Void:
+      break;
     }
+  }
 
-    bool isTrue = false;
-    if (auto *numObj = dynamic_cast<NumberObj *>(condition.get())) {
-      isTrue = numObj->value != 0;
+  CppValue finish(const CppValue &value, Mode mode) {
+    if (mode == Mode::Echo) {
+      print(value);
+      return {};
     }
+    return value;
+  }
 
-    if (!isTrue) {
-      skipExpr(pos, expr);
-      return make_unique<NumberObj>(0);
-    } else {
-      auto out = evalExpr(env, pos, expr);
-      skipExpr(pos, expr);
-      return out;
+  string number(const CppValue &value, string_view form) {
+    if (value.type != CppType::Number) {
+      throw runtime_error(string(form) + " expects numbers");
     }
+    return value.expr;
   }
 
-  if (token == "while") {
-    auto conditionPosition = pos;
-    auto condition = evalExpr(env, pos, expr);
-    if (!condition) {
-      return nullptr;
+  string truthy(const CppValue &value) {
+    return value.type == CppType::Number ? value.expr + " != 0" : "false";
+  }
+
+  CppVariable *find(string_view name) {
+    for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+      auto it = scope->find(name);
+      if (it != scope->end()) {
+        return &it->second;
+      }
     }
+    auto it = globals.find(name);
+    return it != globals.end() ? &it->second : nullptr;
+  }
 
-    bool isTrue = false;
-    if (auto *numObj = dynamic_cast<NumberObj *>(condition.get())) {
-      isTrue = numObj->value != 0;
+  CppVariable &variable(string_view name) {
+    if (CppVariable *var = find(name)) {
+      return *var;
+    }
+    if (functions.count(name) > 0) {
+      throw runtime_error(string(name) +
+                          " is a lambda and can only be called");
     }
+    throw runtime_error("Undefined variable: " + string(name));
+  }
 
-    auto bodyPosition = pos;
-    unique_ptr<Obj> lastResult;
+  CppVariable local(string_view name, CppType type) {
+    return {type, mangle("l_", name) + "_" + to_string(names++)};
+  }
 
-    while (isTrue) {
-      unique_ptr<Obj> bodyResult;
-      while (pos < expr.size()) {
-        auto result = evalExpr(env, pos, expr);
-        if (!result) {
-          return nullptr;
-        }
-        bodyResult = std::move(result);
+  CppValue gen(const Node &node, Mode mode) {
+    switch (node.kind) {
+    case NodeKind::Number:
+      return finish({CppType::Number, literal(node.number)}, mode);
 
-        string_view next = getNextToken(pos, expr);
-        if (next == ")") {
-          break;
-        }
-        pos -= next.length();
-      }
-      lastResult = std::move(bodyResult);
+    case NodeKind::String:
+      return finish({CppType::String, "string(" + quote(node.text) + ")"},
+                    mode);
 
-      pos = conditionPosition;
-      condition = evalExpr(env, pos, expr);
-      if (!condition) {
-        return nullptr;
+    case NodeKind::Symbol: {
+      CppVariable &var = variable(node.text);
+      if (mode == Mode::Discard) {
+        return {};
       }
+      return finish(temp(var.type, var.name), mode);
+    }
 
-      if (auto *numObj = dynamic_cast<NumberObj *>(condition.get())) {
-        isTrue = numObj->value != 0;
-      } else {
-        return nullptr;
+    case NodeKind::Operator: {
+      if (node.children.empty()) {
+        return finish({CppType::Number, "0.0"}, mode);
+      }
+      CppValue result = temp(
+          CppType::Number,
+          number(gen(*node.children[0], Mode::Use), node.text));
+      for (size_t i = 1; i < node.children.size(); i++) {
+        string operand =
+            number(gen(*node.children[i], Mode::Use), node.text);
+        if (node.text == "==" || node.text == "!=") {
+          line(result.expr + " = " + result.expr + " " + string(node.text) +
+               " " + operand + " ? 1.0 : 0.0;");
+        } else {
+          line(result.expr + " = " + result.expr + " " + string(node.text) +
+               " " + operand + ";");
+        }
       }
+      return finish(result, mode);
+    }
 
-      if (isTrue) {
-        pos = bodyPosition;
+    case NodeKind::CompoundAssign: {
+      CppVariable &var = variable(node.children[0]->text);
+      if (var.type != CppType::Number) {
+        throw runtime_error(string(node.text) +
+                            " requires a valid number variable");
+      }
+      string operand = number(gen(*node.children[1], Mode::Use), node.text);
+      if (node.text == "/=") {
+        line("if (" + operand + " == 0) {");
+        depth++;
+        line("throw runtime_error(\"/= cannot divide by zero\");");
+        depth--;
+        line("}");
+      }
+      line(var.name + " " + string(node.text) + " " + operand + ";");
+      if (mode == Mode::Discard) {
+        return {};
       }
+      return finish(temp(CppType::Number, var.name), mode);
     }
 
-    if (!isTrue) {
-      skipExpr(pos, expr);
+    case NodeKind::Define: {
+      if (inFunction || !scopes.empty()) {
+        throw runtime_error("define is only supported at top level");
+      }
+      const Node &value = *node.children[0];
+      if (value.kind == NodeKind::Lambda) {
+        return finish(defineFunction(node.text, value), mode);
+      }
+      if (functions.count(node.text) > 0) {
+        throw runtime_error(string(node.text) + " is already a lambda");
+      }
+      CppValue result = gen(value, Mode::Use);
+      if (!isData(result.type)) {
+        throw runtime_error("define expects a number or a string");
+      }
+      auto [it, added] = globals.try_emplace(
+          node.text, CppVariable{result.type, mangle("g_", node.text)});
+      if (added) {
+        declarations += "static " + string(declaration(result.type)) +
+                        it->second.name + ";\n";
+      } else if (it->second.type != result.type) {
+        throw runtime_error(string(node.text) + " changes type");
+      }
+      line(it->second.name + " = " + result.expr + ";");
+      return finish(result, mode);
     }
 
-    return lastResult ? std::move(lastResult) : make_unique<NumberObj>(0);
-  }
+    case NodeKind::Begin: {
+      CppValue result;
+      for (size_t i = 0; i < node.children.size(); i++) {
+        bool last = i + 1 == node.children.size();
+        result = gen(*node.children[i], last ? mode : Mode::Discard);
+      }
+      return result;
+    }
 
-  if (token == "lambda") {
-    token = getNextToken(pos, expr);
-    if (token != "(") {
-      return nullptr;
+    case NodeKind::Display: {
+      expectArgs(node.children.size(), 1, "display");
+      CppValue value = gen(*node.children[0], Mode::Use);
+      if (value.type == CppType::String) {
+        line("cout << " + value.expr + " << '\\n';");
+      } else if (value.type == CppType::Void) {
+        line("cout << '\\n';");
+      } else {
+        print(value);
+      }
+      return {};
     }
 
-    vector<string_view> params;
-    while (true) {
-      token = getNextToken(pos, expr);
-      if (token == ")")
+    case NodeKind::ToString: {
+      expectArgs(node.children.size(), 1, "toString");
+      CppValue value = gen(*node.children[0], Mode::Use);
+      switch (value.type) {
+      case CppType::Number:
+        return finish(temp(CppType::String, "show(" + value.expr + ")"), mode);
+      case CppType::String:
+        return finish(
+            temp(CppType::String, "\"\\\"\" + " + value.expr + " + \"\\\"\""),
+            mode);
+      case CppType::Lambda:
+        return finish({CppType::String, "string(" + value.expr + ")"}, mode);
+      case CppType::Void:
         break;
-      if (token.empty())
-        return nullptr;
-      params.push_back(token);
-    }
-
-    size_t bodyStart = pos;
-    int parenCount = 0;
-    bool started = false;
-
-    while (pos < expr.size()) {
-      char c = expr[pos];
-      if (c == '(') {
-        started = true;
-        parenCount++;
-      } else if (c == ')') {
-        parenCount--;
-        if (started && parenCount == 0) {
-          pos++;
-          break;
-        }
       }
-      pos++;
+      return finish({CppType::String, "string()"}, mode);
     }
 
-    string_view body = expr.substr(bodyStart, pos - bodyStart - 1);
-    return make_unique<LambdaObj>(params, body);
-  }
+    case NodeKind::If:
+      return genIf(node, mode);
 
-  if (env.contains(token)) {
-    auto obj = env.getClone(token);
-    if (auto *lambda = dynamic_cast<LambdaObj *>(obj.get())) {
-      vector<unique_ptr<Obj>> args;
-      for (size_t i = 0; i < lambda->params.size(); i++) {
-        auto arg = evalExpr(env, pos, expr);
-        if (!arg)
-          return nullptr;
-        args.push_back(std::move(arg));
-      }
+    case NodeKind::While:
+      return genWhile(node, mode);
 
-      Env newEnv(&env);
-      for (size_t i = 0; i < lambda->params.size(); i++) {
-        newEnv.set(lambda->params[i], args[i]->clone());
-      }
+    case NodeKind::Let:
+      return genLet(node, mode);
 
-      size_t bodyPos = 0;
-      return evalExpr(newEnv, bodyPos, lambda->body);
+    case NodeKind::Set: {
+      CppVariable *var = find(node.text);
+      if (!var) {
+        throw runtime_error("Variable not found for set!");
+      }
+      CppValue value = gen(*node.children[0], Mode::Use);
+      if (value.type != var->type) {
+        throw runtime_error("set! changes the type of " + string(node.text));
+      }
+      line(var->name + " = " + value.expr + ";");
+      return finish(value, mode);
     }
-    return obj;
-  }
 
-  if (token == "let") {
-    Env newEnv(&env);
-
-    string_view nextToken = getNextToken(pos, expr);
-    if (nextToken != "(") {
-      return nullptr;
-    }
+    case NodeKind::Apply:
+      return genApply(node, mode);
 
-    while (true) {
-      nextToken = getNextToken(pos, expr);
-      if (nextToken == ")")
-        break;
+    case NodeKind::Lambda:
+      throw runtime_error("lambdas must be bound by a top-level define");
 
-      string_view varName = nextToken;
-      auto varValue = evalExpr(env, pos, expr);
-      if (!varValue)
-        return nullptr;
+    default:
+      throw runtime_error(
+          "lists, vectors and eval cannot be compiled ahead of time");
+    }
+  }
 
-      newEnv.set(varName, varValue->clone());
+  CppValue genIf(const Node &node, Mode mode) {
+    if (node.children.size() < 2 || node.children.size() > 3) {
+      throw runtime_error("if expects a condition and one or two branches");
+    }
+    string condition = truthy(gen(*node.children[0], Mode::Use));
+    string thenCode, elseCode;
+    CppValue thenValue = nested(*node.children[1], mode, thenCode);
+    CppValue elseValue{CppType::Number, "0.0"};
+    if (node.children.size() == 3) {
+      elseValue = nested(*node.children[2], mode, elseCode);
+    } else if (mode == Mode::Echo) {
+      string *outer = out;
+      out = &elseCode;
+      depth++;
+      print(elseValue);
+      depth--;
+      out = outer;
     }
 
-    return evalExpr(newEnv, pos, expr);
+    string result;
+    if (mode == Mode::Use) {
+      if (thenValue.type != elseValue.type ||
+          thenValue.type == CppType::Lambda) {
+        throw runtime_error("if branches have different types");
+      }
+      if (isData(thenValue.type)) {
+        result = fresh("t");
+        line(declaration(thenValue.type) + result + ";");
+      }
+    }
+    line("if (" + condition + ") {");
+    *out += thenCode;
+    assign(result, thenValue);
+    line("} else {");
+    *out += elseCode;
+    assign(result, elseValue);
+    line("}");
+    return result.empty() ? CppValue{} : CppValue{thenValue.type, result};
   }
 
-  if (token == "set!") {
-    string_view varName = getNextToken(pos, expr);
-    auto newValue = evalExpr(env, pos, expr);
-    if (!newValue)
-      return nullptr;
+  CppValue genWhile(const Node &node, Mode mode) {
+    if (node.children.empty()) {
+      throw runtime_error("while expects a condition");
+    }
+    string code;
+    string *outer = out;
+    out = &code;
+    depth++;
+    line("if (!(" + truthy(gen(*node.children[0], Mode::Use)) + ")) {");
+    line("  break;");
+    line("}");
+    CppValue last{CppType::Number, "0.0"};
+    for (size_t i = 1; i < node.children.size(); i++) {
+      bool isLast = i + 1 == node.children.size();
+      last = gen(*node.children[i],
+                 isLast && mode != Mode::Discard ? Mode::Use : Mode::Discard);
+    }
+    depth--;
+    out = outer;
 
-    if (env.setExisting(varName, newValue->clone())) {
-      return newValue;
-    } else {
-      throw runtime_error("Variable not found for set!");
+    // The loop yields its last body value, or 0 when it never ran.
+    if (mode == Mode::Use && last.type != CppType::Number) {
+      throw runtime_error("while yields 0 or its last value");
     }
-  }
+    string result, ran;
+    if (mode != Mode::Discard && last.type != CppType::Void) {
+      result = fresh("t");
+      line(declaration(last.type) + result +
+           (last.type == CppType::Number ? " = 0.0;" : ";"));
+    }
+    if (mode == Mode::Echo && last.type != CppType::Number) {
+      ran = fresh("ran");
+      line("bool " + ran + " = false;");
+    }
+    line("while (true) {");
+    *out += code;
+    assign(result, last);
+    if (!ran.empty()) {
+      assign(ran, {CppType::Number, "true"});
+    }
+    line("}");
 
-  if (token == "eval") {
-    auto exprObj = evalExpr(env, pos, expr);
-    if (auto *strObj = dynamic_cast<StringObj *>(exprObj.get())) {
-      size_t evalPos = 0;
-      return evalExpr(env, evalPos, strObj->value);
+    if (mode == Mode::Discard) {
+      return {};
     }
-    throw runtime_error("eval expects a string argument");
+    if (ran.empty()) {
+      return finish({CppType::Number, result}, mode);
+    }
+    line("if (" + ran + ") {");
+    depth++;
+    print({last.type, result});
+    depth--;
+    line("} else {");
+    depth++;
+    print({CppType::Number, "0.0"});
+    depth--;
+    line("}");
+    return {};
   }
 
-  if (token == "list") {
-    vector<unique_ptr<Obj>> elements;
-    while (true) {
-      auto elem = evalExpr(env, pos, expr);
-      if (!elem)
-        break;
-      elements.push_back(std::move(elem));
+  CppValue genLet(const Node &node, Mode mode) {
+    vector<CppValue> values;
+    for (size_t i = 0; i < node.names.size(); i++) {
+      values.push_back(gen(*node.children[i], Mode::Use));
+      if (!isData(values.back().type)) {
+        throw runtime_error("let binds numbers and strings");
+      }
+    }
 
-      string_view next = getNextToken(pos, expr);
-      if (next == ")")
-        break;
-      pos -= next.length();
+    string code;
+    string *outer = out;
+    out = &code;
+    depth++;
+    scopes.emplace_back();
+    for (size_t i = 0; i < node.names.size(); i++) {
+      CppVariable var = local(node.names[i], values[i].type);
+      line(declaration(var.type) + var.name + " = " + values[i].expr + ";");
+      scopes.back()[node.names[i]] = var;
     }
+    CppValue last;
+    for (size_t i = node.names.size(); i < node.children.size(); i++) {
+      bool isLast = i + 1 == node.children.size();
+      last = gen(*node.children[i], isLast ? mode : Mode::Discard);
+    }
+    scopes.pop_back();
+    depth--;
+    out = outer;
 
-    return make_unique<ListObj>(std::move(elements));
+    string result;
+    if (mode == Mode::Use && isData(last.type)) {
+      result = fresh("t");
+      line(declaration(last.type) + result + ";");
+    } else if (mode == Mode::Use && last.type == CppType::Lambda) {
+      throw runtime_error("lambdas must be bound by a top-level define");
+    }
+    line("{");
+    *out += code;
+    assign(result, last);
+    line("}");
+    return result.empty() ? CppValue{} : CppValue{last.type, result};
   }
 
-  if (token == "get") {
-    auto listObj = evalExpr(env, pos, expr);
-    auto numberObj = evalExpr(env, pos, expr);
-    if (auto *list = dynamic_cast<ListObj *>(listObj.get())) {
-      if (!list->elements.empty()) {
-        auto *number = dynamic_cast<NumberObj *>(numberObj.get());
-        return list->elements[number->value]->clone();
-      }
+  CppValue defineFunction(string_view name, const Node &def) {
+    if (globals.count(name) > 0) {
+      throw runtime_error(string(name) + " is already a variable");
+    }
+    auto [it, added] = functions.try_emplace(name);
+    if (!added && it->second.def != &def) {
+      throw runtime_error(string(name) + " is defined twice");
     }
+    it->second.def = &def;
+    it->second.name = mangle("f_", name);
+    return {CppType::Lambda, quote(LambdaObj(&def).toString())};
   }
 
-  if (token == "car") {
-    auto listObj = evalExpr(env, pos, expr);
-    if (auto *list = dynamic_cast<ListObj *>(listObj.get())) {
-      if (!list->elements.empty()) {
-        return list->elements[0]->clone();
+  CppValue genApply(const Node &node, Mode mode) {
+    const Node &callee = *node.children[0];
+    auto it = callee.kind == NodeKind::Symbol ? functions.find(callee.text)
+                                              : functions.end();
+    if (it == functions.end()) {
+      if (callee.kind == NodeKind::Symbol && node.children.size() == 1) {
+        CppVariable &var = variable(callee.text);
+        return finish(temp(var.type, var.name), mode);
       }
+      throw runtime_error("only lambdas bound by a top-level define can be "
+                          "called");
     }
-    throw runtime_error("car expects a non-empty list");
-  }
 
-  if (token == "cdr") {
-    auto listObj = evalExpr(env, pos, expr);
-    if (auto *list = dynamic_cast<ListObj *>(listObj.get())) {
-      if (list->elements.size() > 1) {
-        vector<unique_ptr<Obj>> tailElements;
-        for (size_t i = 1; i < list->elements.size(); i++) {
-          tailElements.push_back(list->elements[i]->clone());
-        }
-        return make_unique<ListObj>(std::move(tailElements));
+    CppFunction &target = it->second; // args may define more lambdas
+    const Node &def = *target.def;
+    if (node.children.size() - 1 != def.names.size()) {
+      throw runtime_error("lambda expects " + to_string(def.names.size()) +
+                          " argument(s)");
+    }
+    string call = target.name + "(";
+    for (size_t i = 1; i < node.children.size(); i++) {
+      CppValue arg = gen(*node.children[i], Mode::Use);
+      if (arg.type != CppType::Number) {
+        throw runtime_error("lambda arguments must be numbers");
       }
+      call += (i > 1 ? ", " : "") + arg.expr;
     }
-    throw runtime_error("cdr expects a list with at least two elements");
+    call += ")";
+
+    CppType result = compile(target).result;
+    if (result == CppType::Void) {
+      line(call + ";");
+      return {};
+    }
+    return finish(temp(result, call), mode);
   }
 
-  if (token == "cons") {
-    auto firstObj = evalExpr(env, pos, expr);
-    auto listObj = evalExpr(env, pos, expr);
+  // Compiles the body of fn on first use. A recursive call seen while doing
+  // so is assumed to return a number, which is checked after.
+  CppFunction &compile(CppFunction &fn) {
+    if (fn.compiled) {
+      return fn;
+    }
+    if (fn.compiling) {
+      fn.recursive = true;
+      return fn;
+    }
+    fn.compiling = true;
 
-    if (auto *list = dynamic_cast<ListObj *>(listObj.get())) {
-      vector<unique_ptr<Obj>> newElements;
-      newElements.push_back(std::move(firstObj));
-      for (auto &elem : list->elements) {
-        newElements.push_back(elem->clone());
-      }
-      return make_unique<ListObj>(std::move(newElements));
+    string code, *outer = out;
+    int outerDepth = depth;
+    bool outerInFunction = inFunction;
+    vector<Scope> outerScopes;
+    swap(scopes, outerScopes);
+    out = &code;
+    depth = 1;
+    inFunction = true;
+
+    const Node &def = *fn.def;
+    string parameters;
+    scopes.emplace_back();
+    for (auto param : def.names) {
+      CppVariable var = local(param, CppType::Number);
+      parameters += (parameters.empty() ? "double " : ", double ") + var.name;
+      scopes.back()[param] = var;
     }
-    throw runtime_error("cons expects a list as the second argument");
-  }
+    CppValue last;
+    for (size_t i = 0; i < def.children.size(); i++) {
+      bool isLast = i + 1 == def.children.size();
+      last = gen(*def.children[i], isLast ? Mode::Use : Mode::Discard);
+    }
+    if (last.type == CppType::Lambda) {
+      throw runtime_error("lambdas must be bound by a top-level define");
+    }
+    if (fn.recursive && last.type != CppType::Number) {
+      throw runtime_error("recursive lambdas must return numbers");
+    }
+    fn.result = last.type;
 
-  if (token == "len") {
-    auto listObj = evalExpr(env, pos, expr);
-    if (auto *list = dynamic_cast<ListObj *>(listObj.get())) {
-      return make_unique<NumberObj>(list->elements.size());
+    string signature = string("static ") +
+                       (last.type == CppType::Void ? "void "
+                                                   : declaration(last.type)) +
+                       fn.name + "(" + parameters + ")";
+    prototypes += signature + ";\n";
+    if (last.type != CppType::Void) {
+      line("return " + last.expr + ";");
     }
-    throw runtime_error("len expects a list argument");
-  }
+    definitions += signature + " {\n" + code + "}\n\n";
 
-  if (token == "toString") {
-    auto value = evalExpr(env, pos, expr);
-    string_view sv(value->toString());
-    return make_unique<StringObj>(sv);
+    swap(scopes, outerScopes);
+    out = outer;
+    depth = outerDepth;
+    inFunction = outerInFunction;
+    fn.compiling = false;
+    fn.compiled = true;
+    return fn;
   }
+};
+
+enum class Engine { Tree, Bytecode, Closure, Specializing, Stackless };
 
-  cout << "Invalid Input: " << token << endl;
-  return nullptr;
+static const unordered_map<string_view, Engine> engines = {
+    {"tree", Engine::Tree},
+    {"vm", Engine::Bytecode},
+    {"closure", Engine::Closure},
+    {"specialize", Engine::Specializing},
+    {"stackless", Engine::Stackless}};
+
+static Engine engine = Engine::Tree;
+
+Value evalForm(Env &env, const Node &form) {
+  if (engine == Engine::Bytecode) {
+    Chunk chunk;
+    Compiler(chunk).compileForm(form);
+    return vm.run(chunk, env);
+  }
+  if (engine == Engine::Closure) {
+    return compileClosure(form)(env);
+  }
+  if (engine == Engine::Specializing) {
+    return runSpecialized(env, form);
+  }
+  if (engine == Engine::Stackless) {
+    return StacklessMachine().run(env, form);
+  }
+  return evalExpr(env, form);
 }
 
-ObjPtr evalExprs(Env &env, size_t &pos, const string_view expr, size_t end) {
-  ObjPtr result = nullptr;
-  while (pos < end) {
-    result = evalExpr(env, pos, expr);
-    if (result && !dynamic_cast<VoidObj *>(result.get())) {
-      cout << result->toString() << endl;
+// Sources at least this large are read on readThreads threads, every
+// hardware thread unless --read-threads says otherwise.
+static constexpr size_t parallelReadSize = 1 << 20;
+static size_t readThreads = thread::hardware_concurrency();
+
+template <class FormReader>
+static Value evalAll(Env &env, FormReader &reader) {
+  Value result = Value::voidValue();
+  while (const Node *form = reader.read()) {
+    result = evalForm(env, *form);
+    ScratchArena::reset();
+    if (!result.isVoid()) {
+      cout << result.toString() << endl;
     }
   }
   return result;
 }
 
+Value evalExprs(Env &env, string_view source) {
+  unsigned threads = readThreads;
+  if (source.size() >= parallelReadSize && threads > 1) {
+    ParallelReader reader(source, threads);
+    return evalAll(env, reader);
+  }
+  Reader reader(source);
+  return evalAll(env, reader);
+}
+
 void repl() {
   Env globalEnv;
-  vector<string> inputStorage; // 存储输入字符串
+  deque<string> inputStorage; // 存储输入字符串
 
   while (true) {
     cout << ">> ";
     string expr;
     getline(cin, expr);
 
-    if (expr == "exit")
+    if (expr == "exit" || !cin)
       break;
 
     try {
       inputStorage.push_back(std::move(expr));    // 存储输入
       string_view exprView = inputStorage.back(); // 创建视图
-      size_t pos = 0;
-      evalExprs(globalEnv, pos, exprView, exprView.size());
+      evalExprs(globalEnv, exprView);
+    } catch (const exception &e) {
+      cout << "Error: " << e.what() << endl;
+    }
+  }
+}
+
+int runScript(const char *path) {
+  ifstream file(path);
+  if (!file) {
+    cerr << "Cannot open " << path << endl;
+    return 1;
+  }
+  stringstream buffer;
+  buffer << file.rdbuf();
+  string source = buffer.str(); // Outlives every parsed form
+
+  int status = 0;
+  {
+    Env globalEnv;
+    try {
+      evalExprs(globalEnv, source);
     } catch (const exception &e) {
       cout << "Error: " << e.what() << endl;
+      status = 1;
     }
   }
+  ObjHeap::finish();
+  return status;
+}
+
+// Prints the C++ translation of the script at path.
+int emitScript(const char *path) {
+  ifstream file(path);
+  if (!file) {
+    cerr << "Cannot open " << path << endl;
+    return 1;
+  }
+  stringstream buffer;
+  buffer << file.rdbuf();
+  string source = buffer.str();
+
+  try {
+    cout << CppTranspiler().translate(source);
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Counts given on the command line are positive. A free budget of 0 could
+// never free anything it had put off, and reading needs a thread.
+static bool parseCount(string_view text, size_t &count) {
+  size_t parsed = 0;
+  const char *last = text.data() + text.size();
+  auto [end, error] = from_chars(text.data(), last, parsed);
+  if (error != errc() || end != last || parsed == 0) {
+    return false;
+  }
+  count = parsed;
+  return true;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+  const char *script = nullptr;
+  bool emitCpp = false;
+  for (int i = 1; i < argc; i++) {
+    string_view arg = argv[i];
+    if (arg.rfind("--engine=", 0) == 0 && engines.count(arg.substr(9)) > 0) {
+      engine = engines.at(arg.substr(9));
+    } else if (arg == "--jit") {
+      jitEnabled = true;
+    } else if (arg == "--trace") {
+      tracingEnabled = true;
+    } else if (arg.rfind("--free-budget=", 0) == 0 &&
+               parseCount(arg.substr(14), ObjHeap::freeBudget)) {
+    } else if (arg.rfind("--read-threads=", 0) == 0 &&
+               parseCount(arg.substr(15), readThreads)) {
+    } else if (arg == "--emit-cpp") {
+      emitCpp = true;
+    } else if (arg[0] != '-' && !script) {
+      script = argv[i];
+    } else {
+      cerr << "usage: cppLisp "
+              "[--engine=tree|vm|closure|specialize|stackless] [--jit] "
+              "[--trace] [--free-budget=cells] [--read-threads=n] "
+              "[script]\n"
+              "       cppLisp --emit-cpp script"
+           << endl;
+      return 1;
+    }
+  }
+
+  if (emitCpp) {
+    if (!script) {
+      cerr << "--emit-cpp needs a script" << endl;
+      return 1;
+    }
+    return emitScript(script);
+  }
+  if (script) {
+    return runScript(script);
+  }
   repl();
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,11 @@
+(define g (lambda (x) (let (f (lambda () x)) (begin (set! x 2) (f)))))
+(display (g 1))
+(define make-counter (lambda () (let (n 0) (lambda () (+= n 1)))))
+(define counter (make-counter))
+(counter)
+(counter)
+(display (counter))
+(define pair (lambda (n) (list (lambda () (+= n 10)) (lambda () n))))
+(define p (pair 1))
+((car p))
+(display ((get p 1)))
@@ -0,0 +1,6 @@
+(define g 1)
+(define f (lambda (a) (let (b 2) (begin (+= a 3) (-= b 1) (*= a b) (display (+ a b)) (display (- a 1)) (display (* g a)) a))))
+(f 1)
+(+= g 2)
+(define s "x")
+(-= s 1)
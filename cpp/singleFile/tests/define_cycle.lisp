@@ -0,0 +1,5 @@
+(define outer (lambda (n) (begin (define loop (lambda (i acc) (if (== i 0) acc (loop (- i 1) (+ acc i))))) (loop n 0))))
+(define i 0)
+(define total 0)
+(while (!= i 1200000) (+= total (outer 3)) (+= i 1))
+(display total)
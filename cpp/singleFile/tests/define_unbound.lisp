@@ -0,0 +1,23 @@
+(define y 7)
+(define f (lambda () (begin (display y) (define y 5) y)))
+(f)
+(define h (lambda () (begin (define k (lambda () y)) (display (k)) (define y 1) (k))))
+(h)
+(let (a 1) (begin (display y) (define y 2) (+ y a)))
+(define m (lambda () (begin (set! y 8) (define y 3) y)))
+(m)
+(display y)
+(define outer (lambda () (begin (define q 5) ((lambda () q)))))
+(outer)
+(define c 0)
+(define u (lambda () (begin (define n 0) (while (!= n 100) (+= c 1) (+= n 1)) (define c 5) c)))
+(display (u))
+(display c)
+(define p (lambda (x) (begin (+= x y) (define y x) y)))
+(define y 1)
+(define i 0)
+(define t 0)
+(while (!= i 300) (+= t (p i)) (+= i 1))
+(display t)
+(define g (lambda () (begin (define z (+ y 1)) (display z) (display w) (define w 2) w)))
+(g)
@@ -0,0 +1,42 @@
+(define i 0)
+(define s 0)
+(while (!= i 1000) (+= s (* i 2)) (+= i 1))
+(display s)
+(define fib (lambda (n) (if (== n 0) 0 (if (== n 1) 1 (+ (fib (- n 1)) (fib (- n 2)))))))
+(fib 20)
+(define name "hello world")
+name
+(display name)
+(toString name)
+(display (toString 3))
+(let (a 1 b 2) (+ a b))
+(let (a 1) (display a) a)
+(define show (lambda (x) (display x)))
+(show 5)
+(if (== s 0) (display "zero"))
+(if (!= s 0) (display "nonzero") 7)
+(begin (set! i 3) (+= i 2))
+(while (!= i 8) (+= i 1) (display i))
+(while (!= i 8) (+= i 1))
+(define k (while (!= i 10) (+= i 1)))
+k
+(define g (lambda (a b) (let (c (* a b)) (/ c 2))))
+(g 3 4)
+(- 7)
+(+)
+(define sq (lambda (x) (* x x)))
+(define sumsq (lambda (a b) (+ (sq a) (sq b))))
+(sumsq 3 4)
+(define half 0.5)
+(* half 7)
+(/ 1 0)
+(/ 0 0)
+(== (/ 0 0) (/ 0 0))
+(define count (lambda (n acc) (if (== n 0) acc (count (- n 1) (+ acc 1)))))
+(count 10000 0)
+(define j 1)
+(*= j 10)
+(-= j 2.5)
+(display (toString (+ j 0.25)))
+(display (toString (/ 0 0)))
+(/= i 0)
@@ -0,0 +1,8 @@
+(define outer (lambda () (begin (define y 5) ((lambda () y)))))
+(display (outer))
+(define h (lambda (k) (begin (define acc 0) (define add (lambda (z) (+= acc z))) (add k) (add k) acc)))
+(display (h 3))
+(define f (lambda (n) (begin (define fact (lambda (k) (if (== k 0) 1 (* k (fact (- k 1)))))) (fact n))))
+(display (f 5))
+(define w (lambda (n) (let (a 1) (begin (define b (+ a n)) ((lambda () (+ a b)))))))
+(display (w 10))
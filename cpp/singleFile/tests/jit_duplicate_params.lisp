@@ -0,0 +1,6 @@
+(define f (lambda (x x) (+ x 1)))
+(define i 0)
+(define t 0)
+(while (!= i 200) (+= t (f 1 5)) (+= i 1))
+(display (f 1 5))
+(display t)
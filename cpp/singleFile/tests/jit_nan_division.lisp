@@ -0,0 +1,24 @@
+(define div (lambda (a b) (/ a b)))
+(define eq (lambda (a b) (== a b)))
+(define ne (lambda (a b) (!= a b)))
+(define pick (lambda (a b) (if (== a b) 1 2)))
+(define i 0)
+(while (!= i 200) (div i 3) (eq i 1) (ne i 1) (pick i 1) (+= i 1))
+(define inf (div 1 0))
+(define ninf (div -1 0))
+(define nan (div 0 0))
+(define negzero (div 0 -5))
+(eq nan nan)
+(ne nan nan)
+(pick nan nan)
+(eq nan 1)
+(ne 1 nan)
+(eq inf inf)
+(eq inf ninf)
+(ne ninf ninf)
+(eq negzero 0)
+(div 1 negzero)
+(div inf inf)
+(div 7 2)
+(eq (/ 0 0) (/ 0 0))
+(/ 1 0)
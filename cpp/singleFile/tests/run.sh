@@ -0,0 +1,61 @@
+#!/bin/sh
+# Runs every tests/*.lisp script on every engine and compares what it
+# prints with the .out file next to it. Scripts run with their memory
+# capped, so one that leaks fails with bad_alloc instead of passing.
+#
+# usage: tests/run.sh [cppLisp binary]
+# Without a binary, cppLisp.cpp is built into a temporary directory.
+dir=$(cd "$(dirname "$0")" && pwd)
+lisp=$1
+if [ -z "$lisp" ]; then
+  lisp=$(mktemp -d)/cppLisp
+  g++ -std=c++17 -O2 -fno-rtti -o "$lisp" "$dir/../cppLisp.cpp" || exit 1
+fi
+
+failed=0
+for script in "$dir"/*.lisp; do
+  expected="${script%.lisp}.out"
+  for mode in "--engine=tree" "--engine=vm" "--engine=closure" \
+      "--engine=specialize" "--engine=stackless" "--jit" "--trace"; do
+    if ! (ulimit -v 131072; "$lisp" $mode "$script" 2>&1) |
+        diff -u "$expected" - > /dev/null
+    then
+      echo "FAIL $(basename "$script") $mode"
+      failed=1
+    fi
+  done
+done
+# The C++ that --emit-cpp writes has to build and print the same.
+cpp=$(mktemp -d)
+if ! "$lisp" --emit-cpp "$dir/emit_cpp.lisp" > "$cpp/emit_cpp.cpp" ||
+    ! g++ -std=c++17 -O2 -o "$cpp/emit_cpp" "$cpp/emit_cpp.cpp" ||
+    ! "$cpp/emit_cpp" 2>&1 | diff -u "$dir/emit_cpp.out" - > /dev/null
+then
+  echo "FAIL emit_cpp.lisp --emit-cpp"
+  failed=1
+fi
+
+# Only sources of 1 MiB and up go through the parallel reader, so one is
+# made here. Its forms check that they run once each and in order, and
+# strings full of parentheses sit across the chunk boundaries.
+big=$(mktemp -d)/reader.lisp
+awk 'BEGIN {
+  print "(define next 0)"
+  print "(define ok 1)"
+  for (k = 1; k <= 20000; k++) {
+    printf "(set! ok (* ok (== (+= next 1) %d)))\n", k
+    printf "(define text (list \")(\" \"((\"\n  \"(%d\"))\n", k
+  }
+  print "(display ok)"
+  print "next"
+}' > "$big"
+for mode in "--engine=tree" "--engine=vm" "--engine=stackless"; do
+  result=$("$lisp" --read-threads=4 $mode "$big" 2>&1 | tail -n 2)
+  if [ "$result" != "$(printf '1.000000\n20000.000000')" ]; then
+    echo "FAIL parallel reader $mode"
+    failed=1
+  fi
+done
+
+[ $failed = 0 ] && echo "All tests passed"
+exit $failed
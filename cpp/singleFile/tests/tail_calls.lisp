@@ -0,0 +1,16 @@
+(define count (lambda (n acc) (if (== n 0) acc (count (- n 1) (+ acc 1)))))
+(count 1000000 0)
+(define even (lambda (n) (if (== n 0) 1 (odd (- n 1)))))
+(define odd (lambda (n) (if (== n 0) 0 (even (- n 1)))))
+(even 1000001)
+(define build (lambda (n l) (if (== n 0) (len l) (build (- n 1) (cons n l)))))
+(build 1000000 (list))
+(define viaLet (lambda (n) (let (m (- n 1)) (begin (if (== m -1) "done" (viaLet m))))))
+(viaLet 1000000)
+(define viaDefine (lambda (n) (begin (define m (- n 1)) (if (== m -1) n (viaDefine m)))))
+(viaDefine 1000000)
+(define step (lambda (n) (if (== n 0) count (step (- n 1)))))
+((step 1000000) 3 4)
+(define k 0)
+(define last (lambda (n) (if (== n 0) k ((lambda (m) (last m)) (- n 1)))))
+(last 1000000)
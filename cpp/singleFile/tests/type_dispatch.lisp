@@ -0,0 +1,27 @@
+(define l (list 1 "two" (list 3)))
+(define v (vector 1 "two" (list 3)))
+(define f (lambda (x) x))
+(display l)
+(display v)
+(display f)
+(display "s")
+(display (begin))
+(len l)
+(len v)
+(len (list))
+(get l 1)
+(get v 2)
+(car l)
+(cdr l)
+(car (cdr (cdr l)))
+(cons 0 l)
+(toString l)
+(toString v)
+(toString 2.5)
+(eval "(+ 1 2)")
+(push v f)
+(set-nth v 0 l)
+(concat v v)
+(slice v 1 2)
+(f v)
+(car v)
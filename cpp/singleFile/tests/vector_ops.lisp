@@ -0,0 +1,59 @@
+(define build (lambda (n) (begin (define v (vector)) (define i 0) (while (!= i n) (set! v (push v i)) (+= i 1)) v)))
+(define sum (lambda (v) (begin (define s 0) (define i 0) (define n (len v)) (while (!= i n) (+= s (* (+ i 1) (get v i))) (+= i 1)) s)))
+(begin (define a (build 2000)) (len a))
+(begin (define b a) (len b))
+(define i 0)
+(while (!= i 2002) (set! b (set-nth b i (- 0 i))) (+= i 7))
+(sum a)
+(sum b)
+(get b 1995)
+(get b 1996)
+(begin (define c (concat (slice a 5 1037) (slice b 33 1900))) (len c))
+(len c)
+(sum c)
+(begin (define d (concat c c)) (len d))
+(len d)
+(sum d)
+(begin (define e (slice d 100 2500)) (len e))
+(len e)
+(sum e)
+(begin (define f e) (len f))
+(set! i 0)
+(while (!= i 100) (set! f (push f (* i 3))) (+= i 1))
+(len f)
+(sum f)
+(sum e)
+(begin (define g (concat (slice f 1 40) f)) (len g))
+(len g)
+(sum g)
+(get g 38)
+(get g 39)
+(begin (define r (vector)) (len r))
+(define j 0)
+(while (!= j 300) (set! r (concat r (slice a j (+ j 37)))) (+= j 1))
+(len r)
+(sum r)
+(set! j 0)
+(begin (define s r) (len s))
+(while (!= j 11110) (set! s (set-nth s j (+ (get s j) j))) (+= j 101))
+(sum s)
+(sum r)
+(begin (define t (slice s 4321 9876)) (len t))
+(len t)
+(sum t)
+(begin (define u (concat t (concat (vector 1 2 3) (slice r 0 1)))) (len u))
+(len u)
+(sum u)
+(get u 5555)
+(get u 5558)
+(begin (define big (build 40000)) (len big))
+(len big)
+(sum big)
+(begin (define big2 (concat (slice big 31 33000) (slice big 1 32800))) (len big2))
+(len big2)
+(sum big2)
+(get big2 32968)
+(get big2 32969)
+(sum (slice big2 32900 33100))
+(len (slice big 0 0))
+(len (concat (vector) (vector)))